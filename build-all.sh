@@ -16,3 +16,7 @@ PREFIX="$1"
 ./build-libcxx.sh $PREFIX
 ./build-compiler-rt.sh $PREFIX --build-sanitizers
 ./build-libssp.sh $PREFIX
+./build-delayimp.sh $PREFIX
+./build-orderfile-rt.sh $PREFIX
+./build-header-maps.sh $PREFIX
+./build-pch.sh $PREFIX
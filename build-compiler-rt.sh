@@ -51,15 +51,21 @@ fi
 for arch in $ARCHS; do
     buildarchname=$arch
     libarchname=$arch
+    CMAKEFLAGS=""
     if [ -n "$SANITIZERS" ]; then
         case $arch in
         i686|x86_64)
             # Sanitizers on windows only support x86.
             ;;
         *)
-            continue
+            # For other architectures, only build the profile runtime
+            # (for -fprofile-instr-generate and -fprofile-generate).
+            CMAKEFLAGS="$CMAKEFLAGS -DCOMPILER_RT_BUILD_SANITIZERS=OFF"
+            CMAKEFLAGS="$CMAKEFLAGS -DCOMPILER_RT_BUILD_XRAY=OFF"
+            CMAKEFLAGS="$CMAKEFLAGS -DCOMPILER_RT_BUILD_LIBFUZZER=OFF"
             ;;
         esac
+        CMAKEFLAGS="$CMAKEFLAGS -DCOMPILER_RT_BUILD_PROFILE=ON"
     fi
     case $arch in
     armv7)
@@ -95,6 +101,7 @@ for arch in $ARCHS; do
         -DCMAKE_C_COMPILER_TARGET=$buildarchname-windows-gnu \
         -DCOMPILER_RT_DEFAULT_TARGET_ONLY=TRUE \
         -DCOMPILER_RT_USE_BUILTINS_LIBRARY=TRUE \
+        $CMAKEFLAGS \
         $SRC_DIR
     make -j$CORES
     mkdir -p $PREFIX/lib/clang/$CLANG_VERSION/lib/windows
@@ -0,0 +1,29 @@
+#!/bin/sh
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo $0 dest
+    exit 1
+fi
+PREFIX="$1"
+mkdir -p "$PREFIX"
+PREFIX="$(cd "$PREFIX" && pwd)"
+export PATH=$PREFIX/bin:$PATH
+
+: ${ARCHS:=${TOOLCHAIN_ARCHS-i686 x86_64 armv7 aarch64}}
+
+# The delay load helper (__delayLoadHelper2), linked in by the ld wrapper
+# for --delayload=<dll>, and by delay import libraries from dlltool -y.
+unset CCACHE LLVM_MINGW_PROFILE LLVM_MINGW_OBJCACHE LLVM_MINGW_DRIVER_CACHE \
+    LLVM_MINGW_ORDER_INSTRUMENT LLVM_MINGW_PCH
+
+WORK=$(mktemp -d)
+trap "rm -rf $WORK" EXIT
+
+for arch in $ARCHS; do
+    $arch-w64-mingw32-clang -O2 -Wall -c wrappers/delayimp.c -o $WORK/delayimp-$arch.o
+    mkdir -p $PREFIX/$arch-w64-mingw32/lib
+    rm -f $PREFIX/$arch-w64-mingw32/lib/libdelayimp.a
+    $arch-w64-mingw32-ar rcs $PREFIX/$arch-w64-mingw32/lib/libdelayimp.a $WORK/delayimp-$arch.o
+done
@@ -0,0 +1,22 @@
+#!/bin/sh
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo $0 dest
+    exit 1
+fi
+PREFIX="$1"
+PREFIX="$(cd "$PREFIX" && pwd)"
+export PATH=$PREFIX/bin:$PATH
+
+: ${ARCHS:=${TOOLCHAIN_ARCHS-i686 x86_64 armv7 aarch64}}
+
+# The header maps need to be rebuilt whenever headers have been installed
+# or removed, so this should run after everything else that installs
+# headers, but before build-pch.sh.
+unset CCACHE LLVM_MINGW_PROFILE
+rm -rf $PREFIX/share/llvm-mingw/header-maps
+for arch in $ARCHS; do
+    $arch-w64-mingw32-clang --build-header-maps
+done
@@ -0,0 +1,29 @@
+#!/bin/sh
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo $0 dest
+    exit 1
+fi
+PREFIX="$1"
+mkdir -p "$PREFIX"
+PREFIX="$(cd "$PREFIX" && pwd)"
+export PATH=$PREFIX/bin:$PATH
+
+: ${ARCHS:=${TOOLCHAIN_ARCHS-i686 x86_64 armv7 aarch64}}
+
+# The function order tracing runtime (__cyg_profile_func_enter), linked in
+# by the clang wrapper for links with LLVM_MINGW_ORDER_INSTRUMENT set.
+unset CCACHE LLVM_MINGW_PROFILE LLVM_MINGW_OBJCACHE LLVM_MINGW_DRIVER_CACHE \
+    LLVM_MINGW_ORDER_INSTRUMENT LLVM_MINGW_PCH
+
+WORK=$(mktemp -d)
+trap "rm -rf $WORK" EXIT
+
+for arch in $ARCHS; do
+    $arch-w64-mingw32-clang -O2 -Wall -c wrappers/orderfile-rt.c -o $WORK/orderfile-rt-$arch.o
+    mkdir -p $PREFIX/$arch-w64-mingw32/lib
+    rm -f $PREFIX/$arch-w64-mingw32/lib/liborderfile-rt.a
+    $arch-w64-mingw32-ar rcs $PREFIX/$arch-w64-mingw32/lib/liborderfile-rt.a $WORK/orderfile-rt-$arch.o
+done
@@ -0,0 +1,64 @@
+#!/bin/sh
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo $0 dest
+    exit 1
+fi
+PREFIX="$1"
+PREFIX="$(cd "$PREFIX" && pwd)"
+export PATH=$PREFIX/bin:$PATH
+
+: ${ARCHS:=${TOOLCHAIN_ARCHS-i686 x86_64 armv7 aarch64}}
+# Optimization levels to build PCHs for. -O0, -O1 to -O3, and -Os/-Oz
+# each need a PCH of their own.
+: ${PCH_OPT_LEVELS:=-O0 -O2}
+# Sets of macros defined before including windows.h, separated by spaces,
+# with the macros within a set separated by commas, e.g.
+# "none WIN32_LEAN_AND_MEAN,_WIN32_WINNT=0x0601".
+: ${PCH_WINDOWS_MACROS:=none WIN32_LEAN_AND_MEAN}
+: ${PCH_CXX_HEADERS:=iostream string vector}
+
+# The PCHs are built by the clang wrapper, for sample sources that
+# include the headers, with the default options.
+unset CCACHE LLVM_MINGW_PROFILE LLVM_MINGW_OBJCACHE LLVM_MINGW_DRIVER_CACHE \
+    LLVM_MINGW_TIME_TRACE LLVM_MINGW_ORDER_INSTRUMENT LLVM_MINGW_PCH
+export LLVM_MINGW_PCH_CACHE=$PREFIX/share/llvm-mingw/pch
+
+WORK=$(mktemp -d)
+trap "rm -rf $WORK" EXIT
+
+for macros in $PCH_WINDOWS_MACROS; do
+    src=$WORK/windows-$macros
+    : > $src.c
+    if [ "$macros" != "none" ]; then
+        for macro in $(echo $macros | tr , ' '); do
+            echo "#define $macro" | sed 's/=/ /' >> $src.c
+        done
+    fi
+    echo "#include <windows.h>" >> $src.c
+    cp $src.c $src.cpp
+done
+for header in $PCH_CXX_HEADERS; do
+    echo "#include <$header>" > $WORK/$header.cpp
+done
+
+for arch in $ARCHS; do
+    dir=$LLVM_MINGW_PCH_CACHE/$arch-w64-mingw32
+    rm -rf $dir
+    for opt in $PCH_OPT_LEVELS; do
+        for src in $WORK/*.c; do
+            $arch-w64-mingw32-clang $opt -c $src -o $WORK/out.o
+        done
+        for src in $WORK/*.cpp; do
+            $arch-w64-mingw32-clang++ $opt -c $src -o $WORK/out.o
+        done
+    done
+    if ls $dir/*.failed >/dev/null 2>&1; then
+        cat $dir/*.failed
+        echo Failed to build PCHs for $arch
+        exit 1
+    fi
+    echo Built $(ls $dir/*.pch | wc -l) PCHs for $arch
+done
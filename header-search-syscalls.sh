@@ -0,0 +1,35 @@
+#!/bin/sh
+
+# Count the file system syscalls (stat, open and similar) that a compile
+# makes, and how many of them fail, with and without the header maps
+# written by build-header-maps.sh, e.g.
+#   ./header-search-syscalls.sh x86_64-w64-mingw32-clang++ -c foo.cpp -o foo.o
+# PCHs are disabled, as they avoid most of the header lookups anyway.
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo $0 compiler args...
+    exit 1
+fi
+
+OUT=$(mktemp)
+trap "rm -f $OUT" EXIT
+
+for maps in 0 1; do
+    LLVM_MINGW_HEADER_MAPS=$maps LLVM_MINGW_PCH=0 \
+        strace -f -c -o $OUT -e trace=file "$@"
+    if [ $maps = 1 ]; then
+        desc="with header maps:   "
+    else
+        desc="without header maps:"
+    fi
+    awk -v desc="$desc" '
+        $NF ~ /^[a-z_0-9]+$/ && $NF != "total" && $NF != "syscall" {
+            calls += $4
+            if (NF == 6)
+                errors += $5
+        }
+        END { printf "%s %6d calls, %6d failed\n", desc, calls, errors }
+    ' $OUT
+done
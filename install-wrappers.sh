@@ -29,38 +29,27 @@ if [ -n "$EXEEXT" ]; then
 fi
 
 mkdir -p $PREFIX/bin
-cp wrappers/*-wrapper.sh $PREFIX/bin
 if [ -n "$HOST" ]; then
     # TODO: If building natively on msys, pick up the default HOST value from there.
     WRAPPER_FLAGS="$WRAPPER_FLAGS -DDEFAULT_TARGET=\"$HOST\""
-    for i in wrappers/*-wrapper.sh; do
-        cat $i | sed 's/^DEFAULT_TARGET=.*/DEFAULT_TARGET='$HOST/ > $PREFIX/bin/$(basename $i)
-    done
-fi
-$CC wrappers/clang-target-wrapper.c -o $PREFIX/bin/clang-target-wrapper$EXEEXT -O2 -Wl,-s $WRAPPER_FLAGS
-$CC wrappers/windres-wrapper.c -o $PREFIX/bin/windres-wrapper$EXEEXT -O2 -Wl,-s $WRAPPER_FLAGS
-if [ -n "$EXEEXT" ]; then
-    # For Windows, we should prefer the executable wrapper, which also works
-    # when invoked from outside of MSYS.
-    CTW_SUFFIX=$EXEEXT
-    CTW_LINK_SUFFIX=$EXEEXT
-else
-    CTW_SUFFIX=.sh
 fi
+for wrapper in clang-target windres ld objdump dlltool; do
+    $CC wrappers/$wrapper-wrapper.c -o $PREFIX/bin/$wrapper-wrapper$EXEEXT -O2 -Wl,-s $WRAPPER_FLAGS
+done
+for arch in $ARCHS; do
+    cp wrappers/profiles.cfg $PREFIX/bin/$arch-w64-mingw32-profiles.cfg
+done
 cd $PREFIX/bin
 for arch in $ARCHS; do
     for exec in clang clang++ gcc g++ cc c99 c11 c++; do
-        ln -sf clang-target-wrapper$CTW_SUFFIX $arch-w64-mingw32-$exec$CTW_LINK_SUFFIX
+        ln -sf clang-target-wrapper$EXEEXT $arch-w64-mingw32-$exec$EXEEXT
     done
     for exec in ar ranlib nm objcopy strings strip; do
         ln -sf llvm-$exec$EXEEXT $arch-w64-mingw32-$exec$EXEEXT || true
     done
-    for exec in windres; do
+    for exec in windres ld objdump dlltool; do
         ln -sf $exec-wrapper$EXEEXT $arch-w64-mingw32-$exec$EXEEXT
     done
-    for exec in ld objdump dlltool; do
-        ln -sf $exec-wrapper.sh $arch-w64-mingw32-$exec
-    done
 done
 if [ -n "$EXEEXT" ]; then
     if [ ! -L clang$EXEEXT ] && [ -f clang$EXEEXT ] && [ ! -f clang-$CLANG_MAJOR$EXEEXT ]; then
@@ -69,10 +58,7 @@ if [ -n "$EXEEXT" ]; then
     if [ -z "$HOST" ]; then
         HOST=$(./clang-$CLANG_MAJOR -dumpmachine | sed 's/-.*//')-w64-mingw32
     fi
-    for exec in clang clang++ gcc g++ cc c99 c11 c++ ar ranlib nm objcopy strings strip widl windres; do
+    for exec in clang clang++ gcc g++ cc c99 c11 c++ ar ranlib nm objcopy strings strip widl windres ld objdump dlltool; do
         ln -sf $HOST-$exec$EXEEXT $exec$EXEEXT
     done
-    for exec in ld objdump dlltool; do
-        ln -sf $HOST-$exec $exec
-    done
 fi
@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+
+# List the DLLs that a PE executable or DLL pulls in when it is loaded:
+# its imports, and recursively the imports of the DLLs that are found in
+# the search directories (the binary's own directory and the ones given
+# with -L, e.g. the toolchain's <arch>-w64-mingw32/bin). DLLs that are
+# delay loaded (with -Wl,--delayload=<dll>) are listed separately, as they
+# aren't loaded until one of their functions is called.
+
+import argparse
+import os
+import struct
+import sys
+
+
+class PEError(Exception):
+    pass
+
+
+def read_imports(path):
+    # Returns the names of the DLLs in the import directory and the delay
+    # import directory of the image.
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:2] != b"MZ":
+        raise PEError("%s: not a PE image" % path)
+    pe = struct.unpack_from("<I", data, 0x3c)[0]
+    if data[pe:pe + 4] != b"PE\0\0":
+        raise PEError("%s: not a PE image" % path)
+    nb_sections, = struct.unpack_from("<H", data, pe + 6)
+    opt_size, = struct.unpack_from("<H", data, pe + 20)
+    opt = pe + 24
+    magic, = struct.unpack_from("<H", data, opt)
+    if magic == 0x10b:
+        image_base, = struct.unpack_from("<I", data, opt + 28)
+        nb_dirs, = struct.unpack_from("<I", data, opt + 92)
+        dirs = opt + 96
+    elif magic == 0x20b:
+        image_base, = struct.unpack_from("<Q", data, opt + 24)
+        nb_dirs, = struct.unpack_from("<I", data, opt + 108)
+        dirs = opt + 112
+    else:
+        raise PEError("%s: unknown optional header" % path)
+
+    sections = []
+    for i in range(nb_sections):
+        s = opt + opt_size + 40 * i
+        vsize, va, raw_size, raw = struct.unpack_from("<IIII", data, s + 8)
+        sections.append((va, max(vsize, raw_size), raw))
+
+    def offset(rva):
+        for va, size, raw in sections:
+            if va <= rva < va + size:
+                return raw + rva - va
+        raise PEError("%s: rva 0x%x outside of the sections" % (path, rva))
+
+    def string(rva):
+        start = offset(rva)
+        return data[start:data.index(b"\0", start)].decode("latin-1")
+
+    def directory(index):
+        if index >= nb_dirs:
+            return 0
+        return struct.unpack_from("<I", data, dirs + 8 * index)[0]
+
+    imports = []
+    rva = directory(1)
+    while rva:
+        desc = struct.unpack_from("<5I", data, offset(rva))
+        if not any(desc):
+            break
+        imports.append(string(desc[3]))
+        rva += 20
+
+    delayed = []
+    rva = directory(13)
+    while rva:
+        desc = struct.unpack_from("<8I", data, offset(rva))
+        if not any(desc):
+            break
+        # Old style descriptors have addresses instead of RVAs.
+        name = desc[1] if desc[0] & 1 else desc[1] - image_base
+        delayed.append(string(name))
+        rva += 32
+    return imports, delayed
+
+
+class Graph:
+    def __init__(self, dirs):
+        self.dirs = dirs
+        self.nodes = {}
+
+    def find(self, dll):
+        for dir in self.dirs:
+            try:
+                names = os.listdir(dir)
+            except OSError:
+                continue
+            for name in names:
+                if name.lower() == dll.lower():
+                    return os.path.join(dir, name)
+        return None
+
+    def visit(self, key, path):
+        # Returns the (path, imports, delay imports) of a binary, read once.
+        if key not in self.nodes:
+            imports, delayed = [], []
+            if path:
+                try:
+                    imports, delayed = read_imports(path)
+                except (OSError, PEError, struct.error, ValueError) as e:
+                    print("warning: %s" % e, file=sys.stderr)
+            self.nodes[key] = (path, imports, delayed)
+        return self.nodes[key]
+
+    def dll(self, name):
+        return self.visit(name.lower(), self.find(name))
+
+
+def print_tree(graph, name, path, indent, seen, delayed_by):
+    path, imports, delayed = (graph.visit(path, path) if indent == 0
+                              else graph.dll(name))
+    for dll in delayed:
+        delayed_by.setdefault(dll.lower(), (dll, []))[1].append(name)
+    label = name if path else "%s (not found)" % name
+    if name.lower() in seen:
+        # Only expand each DLL the first time it is listed.
+        print("%s%s ..." % ("  " * indent, name) if imports else
+              "%s%s" % ("  " * indent, label))
+        return
+    seen.add(name.lower())
+    print("%s%s" % ("  " * indent, label))
+    for dll in imports:
+        print_tree(graph, dll, None, indent + 1, seen, delayed_by)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=
+        "List the DLLs that a PE binary loads at startup, and the ones it "
+        "delay loads.")
+    parser.add_argument("binary", help="the executable or DLL")
+    parser.add_argument("-L", dest="dirs", action="append", default=[],
+                        help="directory to look for DLLs in (may be "
+                        "repeated; the binary's directory is always "
+                        "searched first)")
+    args = parser.parse_args()
+
+    dirs = [os.path.dirname(os.path.abspath(args.binary))] + args.dirs
+    graph = Graph(dirs)
+    try:
+        read_imports(args.binary)
+    except (OSError, PEError, struct.error, ValueError) as e:
+        print(e, file=sys.stderr)
+        return 1
+
+    seen = set()
+    delayed_by = {}
+    name = os.path.basename(args.binary)
+    print_tree(graph, name, args.binary, 0, seen, delayed_by)
+    # The binary itself isn't one of the loaded DLLs.
+    seen.discard(name.lower())
+    found = sum(1 for dll in seen if graph.nodes[dll][0])
+    print()
+    print("%d DLLs loaded at startup, %d of them found in the search "
+          "directories" % (len(seen), found))
+
+    # DLLs that are both imported and delay loaded are already loaded.
+    delayed = [d for key, d in sorted(delayed_by.items()) if key not in seen]
+    if delayed:
+        print()
+        print("Delay loaded:")
+        for dll, users in delayed:
+            print("  %-24s from %s" % (dll, ", ".join(users)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
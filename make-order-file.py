@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+
+# Turn a function order trace, written by an executable or DLL built with
+# LLVM_MINGW_ORDER_INSTRUMENT=1, into a symbol ordering file for the
+# linker. Relink the (uninstrumented, -ffunction-sections) binary with
+# -Wl,--order-profile=<file> to place the functions that run first next
+# to each other.
+
+import argparse
+import re
+import subprocess
+import sys
+
+
+def run(tool, args):
+    return subprocess.check_output([tool] + args,
+                                   universal_newlines=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=
+        "Produce a link order file from an .order-trace file.")
+    parser.add_argument("binary",
+                        help="the instrumented executable or DLL, with symbols")
+    parser.add_argument("trace", help="the .order-trace file")
+    parser.add_argument("-o", "--output", help="output file (default stdout)")
+    parser.add_argument("--nm", default="llvm-nm")
+    parser.add_argument("--readobj", default="llvm-readobj")
+    args = parser.parse_args()
+
+    headers = run(args.readobj, ["--file-headers", args.binary])
+    image_base = int(re.search(r"ImageBase: (0x[0-9a-fA-F]+)",
+                               headers).group(1), 16)
+    i386 = "COFF-i386" in headers
+
+    # Map the RVAs of functions to their names, preferring global symbols.
+    names = {}
+    for line in run(args.nm, ["--defined-only", args.binary]).splitlines():
+        fields = line.split()
+        if len(fields) != 3 or fields[1] not in ("T", "t"):
+            continue
+        rva = int(fields[0], 16) - image_base
+        if rva not in names or fields[1] == "T":
+            names[rva] = fields[2]
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    missing = 0
+    seen = set()
+    with open(args.trace) as f:
+        for line in f:
+            rva = int(line, 16)
+            name = names.get(rva)
+            if name is None:
+                missing += 1
+                continue
+            if name in seen:
+                continue
+            seen.add(name)
+            # lld adds the underscore prefix of i386 symbols itself.
+            if i386 and name.startswith("_"):
+                name = name[1:]
+            out.write(name + "\n")
+    if args.output:
+        out.close()
+    if missing:
+        print("%d traced functions had no symbol (is %s stripped?)" %
+              (missing, args.binary), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,44 @@
+#!/bin/sh
+
+# Time the objdump -f probes that libtool runs on import libraries, with
+# the objdump wrapper reading the headers itself and with it running
+# llvm-readobj (LLVM_MINGW_BUILTIN_OBJDUMP=0), over all the libraries
+# of one architecture in a toolchain, e.g.
+#   ./objdump-f-benchmark.sh /opt/llvm-mingw x86_64
+# The outputs of the two are compared as well.
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo $0 prefix [arch]
+    exit 1
+fi
+PREFIX="$1"
+ARCH="${2:-x86_64}"
+OBJDUMP="$PREFIX/bin/$ARCH-w64-mingw32-objdump"
+
+LIBS=$(ls "$PREFIX/$ARCH-w64-mingw32/lib/"*.a)
+echo "$(echo "$LIBS" | wc -l) libraries"
+
+OUT=$(mktemp -d)
+trap "rm -rf $OUT" EXIT
+
+for builtin in 1 0; do
+    start=$(date +%s%N)
+    for lib in $LIBS; do
+        LLVM_MINGW_BUILTIN_OBJDUMP=$builtin "$OBJDUMP" -f "$lib"
+    done > $OUT/$builtin.txt
+    end=$(date +%s%N)
+    if [ $builtin = 1 ]; then
+        desc="builtin:     "
+    else
+        desc="llvm-readobj:"
+    fi
+    echo "$desc $(( (end - start) / 1000000 )) ms"
+done
+
+if ! cmp -s $OUT/1.txt $OUT/0.txt; then
+    echo "The outputs differ:"
+    diff -u $OUT/0.txt $OUT/1.txt | head -20
+    exit 1
+fi
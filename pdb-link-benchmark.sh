@@ -0,0 +1,104 @@
+#!/bin/sh
+
+# Time PDB links of a generated C++ project with many translation units
+# that share types, and measure the peak memory use of the linker, with
+# CodeView types merged by lld itself and with global type hashing
+# (LLVM_MINGW_GHASH=1), e.g.
+#   ./pdb-link-benchmark.sh /opt/llvm-mingw x86_64 400
+# The objects are compiled separately for the two modes. The link time
+# and peak memory use are taken from the LLVM_MINGW_TRACE events of the
+# links, which include lld, as it is run by clang.
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo $0 prefix [arch] [translation-units]
+    exit 1
+fi
+PREFIX="$1"
+ARCH="${2:-x86_64}"
+NB="${3:-300}"
+CXX="$PREFIX/bin/$ARCH-w64-mingw32-clang++"
+
+DIR=$(mktemp -d)
+trap "rm -rf $DIR" EXIT
+
+cat > $DIR/types.h <<EOF
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+template <int N> struct Record {
+    std::vector<int> values;
+    std::string names[N + 1];
+    virtual ~Record() {}
+    virtual int size() const { return values.size() + N; }
+};
+
+template <int N> struct Node {
+    std::unique_ptr<Node<N>> next;
+    std::map<int, Record<N>> records;
+    int depth() const { return next ? next->depth() + 1 : N; }
+};
+EOF
+
+i=0
+while [ $i -lt $NB ]; do
+    cat > $DIR/tu$i.cpp <<EOF
+#include "types.h"
+
+namespace tu$i {
+struct Local {
+    std::map<std::string, Record<$i % 16>> records;
+    std::vector<Node<$i % 8>> nodes;
+    std::function<int(int)> callback;
+};
+
+int run(int x) {
+    Local local;
+    local.records["a"].values.push_back(x);
+    local.nodes.emplace_back();
+    local.callback = [&](int y) { return y + x; };
+    std::unordered_map<int, std::shared_ptr<Local>> map;
+    map[x] = std::make_shared<Local>();
+    map[x]->callback = local.callback;
+    return local.callback(x) + map.size() + local.nodes[0].depth();
+}
+}
+
+int tu${i}_run(int x) { return tu$i::run(x); }
+EOF
+    echo "int tu${i}_run(int x);" >> $DIR/main.cpp
+    i=$((i + 1))
+done
+echo "int main() {" >> $DIR/main.cpp
+echo "    int sum = 0;" >> $DIR/main.cpp
+i=0
+while [ $i -lt $NB ]; do
+    echo "    sum += tu${i}_run(sum);" >> $DIR/main.cpp
+    i=$((i + 1))
+done
+echo "    return sum == 0;" >> $DIR/main.cpp
+echo "}" >> $DIR/main.cpp
+
+echo "$((NB + 1)) translation units"
+
+for ghash in 0 1; do
+    mkdir $DIR/$ghash
+    cd $DIR/$ghash
+    LLVM_MINGW_GHASH=$ghash "$CXX" -c -g -gcodeview ../*.cpp
+    LLVM_MINGW_GHASH=$ghash LLVM_MINGW_TRACE=$DIR/trace-$ghash \
+        "$CXX" *.o -o bench.exe -Wl,--pdb=
+    sed -n 's/.*"dur":\([0-9]*\).*"maxrss_kb":\([0-9]*\).*/\1 \2/p' \
+        $DIR/trace-$ghash/events.jsonl > $DIR/link-$ghash
+    read us kb < $DIR/link-$ghash
+    if [ $ghash = 1 ]; then
+        desc="ghash:  "
+    else
+        desc="default:"
+    fi
+    echo "$desc link $((us / 1000)) ms, peak RSS $((kb / 1024)) MB, PDB $(($(wc -c < bench.pdb) / 1024)) KB"
+done
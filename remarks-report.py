@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+
+# Summarize the optimization records collected by the clang wrapper with
+# LLVM_MINGW_REMARKS=dir: the loops that failed to vectorize and why,
+# grouped by source file and target, the loops that only got vectorized
+# for some targets, and the most common reasons for functions not being
+# inlined. With profile data (-fprofile-instr-use), the remarks carry the
+# hotness of the code, and the hottest loops are listed first.
+
+import argparse
+import glob
+import json
+import os
+import re
+import sys
+
+
+def scalar(value):
+    value = value.strip()
+    if len(value) >= 2 and value[0] == value[-1] == "'":
+        return value[1:-1].replace("''", "'")
+    if len(value) >= 2 and value[0] == value[-1] == '"':
+        try:
+            return json.loads(value)
+        except ValueError:
+            return value[1:-1]
+    return value
+
+
+def inline_map(value):
+    # E.g. "{ File: foo.c, Line: 10, Column: 5 }"
+    return {key: scalar(val) for key, val in
+            re.findall(r"(\w+):\s*('(?:[^']|'')*'|[^,}]*)", value)}
+
+
+# A parser for the subset of YAML that LLVM writes optimization records
+# in, to avoid depending on PyYAML: one document per remark, with the
+# type as the tag, top level keys, and a list of message arguments.
+def read_remarks(path):
+    remark = None
+    with open(path) as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if line.startswith("--- !"):
+                remark = {"Type": line[5:].strip(), "Args": []}
+            elif remark is None:
+                continue
+            elif line == "...":
+                yield remark
+                remark = None
+            elif not line.startswith(" "):
+                key, _, value = line.partition(":")
+                if key == "DebugLoc":
+                    remark[key] = inline_map(value)
+                elif key != "Args":
+                    remark[key] = scalar(value)
+            elif line.strip().startswith("- "):
+                # Nested keys of an argument (its DebugLoc) are skipped.
+                key, _, value = line.strip()[2:].partition(":")
+                remark["Args"].append((key.strip(), scalar(value)))
+    if remark is not None:
+        yield remark
+
+
+def message(remark):
+    return "".join(value for key, value in remark["Args"]
+                   if key != "DebugLoc")
+
+
+def location(remark):
+    loc = remark.get("DebugLoc", {})
+    return (loc.get("File", "?"), int(loc.get("Line", 0)),
+            int(loc.get("Column", 0)))
+
+
+def hotness(remark):
+    return int(remark.get("Hotness", 0))
+
+
+class Loop:
+    def __init__(self, function):
+        self.function = function
+        self.vectorized = None
+        self.missed = None
+        self.reasons = []
+        self.hotness = 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=
+        "Summarize the optimization records collected with "
+        "LLVM_MINGW_REMARKS=dir.")
+    parser.add_argument("dir", help="the LLVM_MINGW_REMARKS directory")
+    parser.add_argument("-n", "--top", type=int, default=30,
+                        help="number of entries to list (default 30)")
+    parser.add_argument("-t", "--target",
+                        help="only include records for this target")
+    parser.add_argument("-f", "--file",
+                        help="only include loops in source files matching "
+                             "this regular expression")
+    args = parser.parse_args()
+
+    # Loops by (file, line, column), and then by target. Headers are
+    # compiled in many translation units, so the same remark often
+    # appears many times.
+    loops = {}
+    counts = {}
+    inlining = {}
+    seen = set()
+    nb_files = 0
+    for path in sorted(glob.glob(os.path.join(args.dir, "*", "*.opt.yaml"))):
+        target = os.path.basename(os.path.dirname(path))
+        if args.target and target != args.target:
+            continue
+        nb_files += 1
+        for remark in read_remarks(path):
+            loc = location(remark)
+            text = message(remark)
+            key = (target, remark["Type"], remark.get("Pass"),
+                   remark.get("Name"), loc, text)
+            if key in seen:
+                continue
+            seen.add(key)
+            kind = (target, remark.get("Pass", "?"), remark["Type"])
+            counts[kind] = counts.get(kind, 0) + 1
+
+            if remark.get("Pass") == "inline" and remark["Type"] == "Missed":
+                # Drop the names and costs to group by the reason.
+                reason = re.sub(r"^.*? not inlined into .*? because ", "",
+                                text)
+                reason = re.sub(r"\s*\(.*\)$", "", reason)
+                inlining[reason] = inlining.get(reason, 0) + 1
+                continue
+            if remark.get("Pass") != "loop-vectorize":
+                continue
+            if args.file and not re.search(args.file, loc[0]):
+                continue
+            loop = loops.setdefault(loc, {}).setdefault(
+                target, Loop(remark.get("Function", "?")))
+            loop.hotness = max(loop.hotness, hotness(remark))
+            if remark["Type"] == "Passed":
+                loop.vectorized = text
+            elif remark["Type"] == "Missed":
+                loop.missed = text
+            elif remark["Type"] == "Analysis" and text not in loop.reasons:
+                loop.reasons.append(text)
+    if not nb_files:
+        print("No optimization records in %s" % args.dir, file=sys.stderr)
+        return 1
+    print("%d translation units" % nb_files)
+
+    print()
+    print("Remarks per target and pass (count):")
+    for (target, pass_name, kind), count in sorted(counts.items()):
+        print("%8d  %-24s %-16s %s" % (count, target, pass_name, kind))
+
+    print()
+    print("Loops not vectorized, by file and target:")
+    by_file = {}
+    for loc, targets in loops.items():
+        for target, loop in targets.items():
+            if loop.missed is not None and loop.vectorized is None:
+                by_file.setdefault(loc[0], []).append((loc, target, loop))
+    for file in sorted(by_file, key=lambda f: -max(
+            loop.hotness for _, _, loop in by_file[f])):
+        print(file)
+        entries = sorted(by_file[file],
+                         key=lambda e: (e[1], -e[2].hotness, e[0]))
+        last_target = None
+        for (_, line, column), target, loop in entries[:args.top]:
+            if target != last_target:
+                print("  %s" % target)
+                last_target = target
+            hot = " (hotness %d)" % loop.hotness if loop.hotness else ""
+            print("    %d:%d in %s%s" % (line, column, loop.function, hot))
+            for reason in loop.reasons or [loop.missed]:
+                print("      %s" % reason)
+        if len(entries) > args.top:
+            print("  (%d more)" % (len(entries) - args.top))
+
+    print()
+    print("Loops vectorized for some targets only:")
+    for loc, targets in sorted(loops.items()):
+        done = sorted(t for t, l in targets.items() if l.vectorized)
+        missed = sorted(t for t, l in targets.items()
+                        if l.missed is not None and not l.vectorized)
+        if done and missed:
+            print("  %s:%d:%d: vectorized for %s, not for %s" %
+                  (loc[0], loc[1], loc[2], ", ".join(done),
+                   ", ".join(missed)))
+
+    print()
+    print("Most common reasons for not inlining (count):")
+    for reason, count in sorted(inlining.items(),
+                                key=lambda x: -x[1])[:args.top]:
+        print("%8d  %s" % (count, reason))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
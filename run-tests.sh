@@ -12,6 +12,22 @@ export PATH=$PREFIX/bin:$PATH
 : ${ARCHS:=${TOOLCHAIN_ARCHS-i686 x86_64 armv7 aarch64}}
 
 cd test
+
+# Some tests need options that the lld and clang versions pinned in
+# build-llvm.sh may not support; those tests are skipped then.
+LLD_THINLTO_CACHE=
+if ld.lld -m i386pep --thinlto-cache-dir=thinlto-probe --version > /dev/null 2>&1; then
+    LLD_THINLTO_CACHE=1
+fi
+LLD_XLINK=
+if ld.lld -m i386pep -Xlink=-debug:ghash --version > /dev/null 2>&1; then
+    LLD_XLINK=1
+fi
+CLANG_LD_PATH=
+if clang --ld-path=ld.lld -### -x c /dev/null > /dev/null 2>&1; then
+    CLANG_LD_PATH=1
+fi
+
 TESTS_C="hello hello-tls crt-test setjmp"
 TESTS_C_DLL="autoimport-lib"
 TESTS_C_LINK_DLL="autoimport-main"
@@ -21,6 +37,8 @@ TESTS_CPP_DLL="tlstest-lib"
 TESTS_SSP="stacksmash"
 TESTS_ASAN="stacksmash"
 TESTS_UBSAN="ubsan"
+# The wrappers don't run more jobs than make -jN allows.
+./jobserver-test.sh
 for arch in $ARCHS; do
     mkdir -p $arch
     for test in $TESTS_C; do
@@ -37,6 +55,113 @@ for arch in $ARCHS; do
         $arch-w64-mingw32-clang $test.c -o $arch/$test-no-builtin.exe -fno-builtin
         TESTS_EXTRA="$TESTS_EXTRA $test-no-builtin"
     done
+    # Pass the arguments in a response file, and force the wrapper to pass
+    # them on to clang in a new one.
+    echo "hello.c -o $arch/hello-rsp.exe" > $arch/hello-rsp.rsp
+    LLVM_MINGW_RSP_THRESHOLD=1 $arch-w64-mingw32-clang @$arch/hello-rsp.rsp
+    TESTS_EXTRA="$TESTS_EXTRA hello-rsp"
+    # The object cache handles dependency files: the second compile, to
+    # another object, is a hit, and its dependency file names that object.
+    OBJCACHE=$(pwd)/$arch/objcache
+    rm -rf $OBJCACHE
+    LLVM_MINGW_OBJCACHE=$OBJCACHE $arch-w64-mingw32-clang -c hello.c -o $arch/hello-dep1.o -MD -MP
+    LLVM_MINGW_OBJCACHE=$OBJCACHE $arch-w64-mingw32-clang -c hello.c -o $arch/hello-dep2.o -MD -MP
+    LLVM_MINGW_OBJCACHE=$OBJCACHE $arch-w64-mingw32-clang --objcache-stats | grep -q "cache hits *1$"
+    grep -q "^$arch/hello-dep2.o:" $arch/hello-dep2.d
+    cmp $arch/hello-dep1.o $arch/hello-dep2.o
+    if [ -n "$CLANG_LD_PATH" ]; then
+        # Links through clang go through the link cache; the second one
+        # is restored from it.
+        LLVM_MINGW_OBJCACHE=$OBJCACHE LLVM_MINGW_LINK_CACHE=1 $arch-w64-mingw32-clang $arch/hello-dep2.o -o $arch/hello-dep.exe
+        rm $arch/hello-dep.exe
+        LLVM_MINGW_OBJCACHE=$OBJCACHE LLVM_MINGW_LINK_CACHE=1 $arch-w64-mingw32-clang $arch/hello-dep2.o -o $arch/hello-dep.exe
+        LLVM_MINGW_OBJCACHE=$OBJCACHE $arch-w64-mingw32-clang --objcache-stats | grep -q "cache hits *2$"
+    else
+        $arch-w64-mingw32-clang $arch/hello-dep2.o -o $arch/hello-dep.exe
+    fi
+    TESTS_EXTRA="$TESTS_EXTRA hello-dep"
+    if [ -n "$LLD_THINLTO_CACHE" ]; then
+        # A relink with ThinLTO should get all modules from the cache,
+        # without adding any new entries.
+        LTO_CACHE=$(pwd)/$arch/thinlto-cache
+        rm -rf $LTO_CACHE
+        $arch-w64-mingw32-clang -flto=thin -c hello.c -o $arch/hello-lto.o
+        LLVM_MINGW_THINLTO_CACHE=$LTO_CACHE $arch-w64-mingw32-clang -flto=thin $arch/hello-lto.o -o $arch/hello-lto.exe
+        ls $LTO_CACHE/$arch-w64-mingw32 | grep llvmcache- > $arch/thinlto-cache-1.txt
+        LLVM_MINGW_THINLTO_CACHE=$LTO_CACHE $arch-w64-mingw32-clang -flto=thin $arch/hello-lto.o -o $arch/hello-lto.exe
+        ls $LTO_CACHE/$arch-w64-mingw32 | grep llvmcache- > $arch/thinlto-cache-2.txt
+        cmp $arch/thinlto-cache-1.txt $arch/thinlto-cache-2.txt
+        TESTS_EXTRA="$TESTS_EXTRA hello-lto"
+    fi
+    # The first compile builds a PCH for windows.h, the second one uses it.
+    PCH_CACHE=$(pwd)/$arch/pch-cache
+    rm -rf $PCH_CACHE
+    printf '#define WIN32_LEAN_AND_MEAN\n#include <windows.h>\n#include "../hello.c"\n' > $arch/hello-pch.c
+    LLVM_MINGW_PCH_CACHE=$PCH_CACHE $arch-w64-mingw32-clang -c $arch/hello-pch.c -o $arch/hello-pch.o
+    ls $PCH_CACHE/$arch-w64-mingw32/*.pch > /dev/null
+    rm -rf $arch/pch-trace
+    LLVM_MINGW_TRACE=$(pwd)/$arch/pch-trace LLVM_MINGW_PCH_CACHE=$PCH_CACHE $arch-w64-mingw32-clang -c $arch/hello-pch.c -o $arch/hello-pch.o
+    # Clang was run once, with the PCH, and didn't reject it.
+    test $(wc -l < $arch/pch-trace/events.jsonl) = 1
+    grep -q include-pch $arch/pch-trace/events.jsonl
+    if ls $PCH_CACHE/$arch-w64-mingw32/*.failed 2>/dev/null; then
+        exit 1
+    fi
+    $arch-w64-mingw32-clang $arch/hello-pch.o -o $arch/hello-pch.exe
+    TESTS_EXTRA="$TESTS_EXTRA hello-pch"
+    if [ -n "$LLD_XLINK" ]; then
+        case $arch in
+        i686|x86_64)
+            # A PDB link with the types merged by their global hashes.
+            LLVM_MINGW_GHASH=1 $arch-w64-mingw32-clang++ hello-cpp.cpp -g -gcodeview -o $arch/hello-ghash.exe -Wl,-pdb,$arch/hello-ghash.pdb
+            TESTS_EXTRA="$TESTS_EXTRA hello-ghash"
+            ;;
+        esac
+    fi
+    # With header maps, includes are still found, and ones with the wrong
+    # case are still rejected.
+    LLVM_MINGW_HEADER_MAPS=1 $arch-w64-mingw32-clang++ hello-cpp.cpp -o $arch/hello-hmap.exe
+    TESTS_EXTRA="$TESTS_EXTRA hello-hmap"
+    printf '#include <Windows.h>\n' > $arch/hello-hmap-case.c
+    if LLVM_MINGW_HEADER_MAPS=1 $arch-w64-mingw32-clang -c $arch/hello-hmap-case.c -o $arch/hello-hmap-case.o; then
+        exit 1
+    fi
+    # The windres wrapper converts .res files to objects itself; the result
+    # should be identical to that of llvm-cvtres, apart from the timestamp.
+    head -c 100000 $arch/hello.exe > $arch/hello-res.bin
+    printf '1 RCDATA "hello-res.bin"\nNAMED CUSTOM { "data" }\nSTRINGTABLE { 1, "hello" }\n' > $arch/hello-res.rc
+    $arch-w64-mingw32-windres -O res -MD $arch/hello-res.rc $arch/hello-res.res
+    grep -q hello-res.bin $arch/hello-res.d
+    $arch-w64-mingw32-windres -J res $arch/hello-res.res $arch/hello-res.o
+    LLVM_MINGW_BUILTIN_CVTRES=0 $arch-w64-mingw32-windres -J res $arch/hello-res.res $arch/hello-res-cvtres.o
+    for obj in hello-res hello-res-cvtres; do
+        head -c 4 $arch/$obj.o > $arch/$obj.cmp
+        tail -c +9 $arch/$obj.o >> $arch/$obj.cmp
+    done
+    cmp $arch/hello-res.cmp $arch/hello-res-cvtres.cmp
+    $arch-w64-mingw32-clang hello.c $arch/hello-res.o -o $arch/hello-res.exe
+    TESTS_EXTRA="$TESTS_EXTRA hello-res"
+    # Delay load user32.dll, both through lld (if it has -Xlink, for
+    # -delayload) and through a delay import library from the dlltool
+    # wrapper.
+    if [ -n "$LLD_XLINK" ]; then
+        $arch-w64-mingw32-clang delayload.c -o $arch/delayload.exe -Wl,--delayload=user32.dll
+        ../load-graph-report.py $arch/delayload.exe | grep -qi "user32.dll *from delayload.exe"
+        TESTS_EXTRA="$TESTS_EXTRA delayload"
+    fi
+    if [ "$arch" = "i686" ]; then
+        printf 'LIBRARY user32.dll\nEXPORTS\nCharUpperA@4\nCharLowerA@4\n' > $arch/delayload.def
+    else
+        printf 'LIBRARY user32.dll\nEXPORTS\nCharUpperA\nCharLowerA\n' > $arch/delayload.def
+    fi
+    $arch-w64-mingw32-dlltool -k -d $arch/delayload.def -y $arch/libuser32-delay.a
+    $arch-w64-mingw32-clang delayload.c -o $arch/delayload-dlltool.exe -L$arch -luser32-delay
+    # The delay import library doesn't fill in the delay import directory,
+    # so user32.dll isn't listed as delay loaded there.
+    if ../load-graph-report.py $arch/delayload-dlltool.exe | grep -qi "user32.dll *from"; then
+        exit 1
+    fi
+    TESTS_EXTRA="$TESTS_EXTRA delayload-dlltool"
     for test in $TESTS_CPP; do
         $arch-w64-mingw32-clang++ $test.cpp -o $arch/$test.exe
     done
@@ -105,5 +230,26 @@ for arch in $ARCHS; do
             $RUN $file
         fi
     done
+    if [ "$RUN" = "wine" ]; then
+        # Profile guided optimization: Build an instrumented executable,
+        # run it, merge the profile and rebuild with it.
+        $arch-w64-mingw32-clang ../hello.c -O2 -fprofile-instr-generate -o hello-pgo-gen.exe
+        rm -f hello-pgo.profraw
+        LLVM_PROFILE_FILE=hello-pgo.profraw $RUN hello-pgo-gen.exe
+        llvm-profdata merge -o hello-pgo.profdata hello-pgo.profraw
+        $arch-w64-mingw32-clang ../hello.c -O2 -fprofile-instr-use=hello-pgo.profdata -Werror=profile-instr-unprofiled -Werror=profile-instr-out-of-date -o hello-pgo.exe
+        $RUN hello-pgo.exe
+    fi
+    if [ "$RUN" = "wine" ] && [ -n "$LLD_XLINK" ]; then
+        # Function ordering: Record the order in which functions first run,
+        # and relink with the functions in that order (with -Xlink=-order).
+        LLVM_MINGW_ORDER_INSTRUMENT=1 $arch-w64-mingw32-clang++ ../hello-cpp.cpp -O2 -o hello-order-gen.exe
+        rm -f hello-order-gen.exe.order-trace
+        $RUN hello-order-gen.exe
+        ../../make-order-file.py hello-order-gen.exe hello-order-gen.exe.order-trace -o hello-order.txt
+        grep -qx main hello-order.txt
+        $arch-w64-mingw32-clang++ ../hello-cpp.cpp -O2 -ffunction-sections -Wl,--order-profile=hello-order.txt -o hello-order.exe
+        $RUN hello-order.exe
+    fi
     cd ..
 done
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2018 Martin Storsjo
+ *
+ * This file is part of llvm-mingw.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Linked with user32.dll delay loaded; the notification hook counts how
+// many times the helper is asked to load it.
+
+#include <windows.h>
+
+static int loads;
+
+static FARPROC WINAPI hook(unsigned notify, void *info) {
+    if (notify == 1) // dliNotePreLoadLibrary
+        loads++;
+    return NULL;
+}
+
+FARPROC (WINAPI *__pfnDliNotifyHook2)(unsigned, void *) = hook;
+
+int main(int argc, char *argv[]) {
+    char str[] = "hello";
+    if (loads != 0) return 1;
+    CharUpperA(str);
+    if (lstrcmpA(str, "HELLO")) return 1;
+    CharLowerA(str);
+    if (lstrcmpA(str, "hello")) return 1;
+    CharUpperA(str);
+    if (loads != 1) return 1;
+    return 0;
+}
@@ -0,0 +1,153 @@
+#!/bin/sh
+
+# Check that the clang and ld wrappers stay within the job limit of make
+# -jN, with multi source compiles that the clang wrapper runs in parallel
+# and with links that get the linker threads limited to the jobserver
+# tokens they hold (LLVM_MINGW_LINK_JOBSERVER=1). Recipes not marked with
+# "+" don't get the jobserver from make 4.3 and older, and must run
+# serially then. The installed wrappers
+# (found in $PATH) are run with fake clang and ld.lld tools, which record
+# how many threads are running in total while they run.
+
+set -e
+
+case $(uname) in
+MINGW*)
+    # The wrappers only use the jobserver on unix hosts.
+    exit 0
+    ;;
+esac
+
+JOBS=4
+BIN="$(dirname "$(command -v x86_64-w64-mingw32-clang)")"
+
+DIR=$(mktemp -d)
+trap "rm -rf $DIR" EXIT
+mkdir -p $DIR/bin $DIR/running
+cp "$BIN/clang-target-wrapper" $DIR/bin/x86_64-w64-mingw32-clang
+cp "$BIN/ld-wrapper" $DIR/bin/x86_64-w64-mingw32-ld
+
+# Each tool counts as one thread, or as many as it is told to use with
+# --threads=N. Compiles only create their output, links run for a while.
+# With --ld-path, clang only runs the linker. If FREE_TOKENS_LOG is set,
+# the linker also logs its threads and the tokens left in the jobserver.
+for tool in clang ld.lld; do
+    cat > $DIR/bin/$tool <<EOF
+#!/bin/sh
+threads=1
+out=
+prev=
+ld=
+ld_args=
+for arg in "\$@"; do
+    case \$arg in
+    *--threads=*) threads=\${arg##*=} ;;
+    --ld-path=*) ld=\${arg#--ld-path=} ;;
+    esac
+    case \$arg in
+    -Wl,*) ld_args="\$ld_args \$(echo \${arg#-Wl,} | tr , ' ')" ;;
+    -o) ld_args="\$ld_args -o" ;;
+    -*) ;;
+    *) ld_args="\$ld_args \$arg" ;;
+    esac
+    if [ "\$prev" = "-o" ]; then
+        out=\$arg
+    fi
+    prev=\$arg
+done
+if [ -n "\$ld" ]; then
+    exec \$ld \$ld_args
+fi
+echo \$threads > $DIR/running/\$\$
+cat $DIR/running/* 2> /dev/null | awk '{ sum += \$1 } END { print sum }' >> $DIR/threads.log
+if [ -n "\$FREE_TOKENS_LOG" ]; then
+    echo \$threads \$(python3 $DIR/free-tokens.py) >> \$FREE_TOKENS_LOG
+fi
+sleep 0.2
+rm $DIR/running/\$\$
+if [ -n "\$out" ]; then
+    touch "\$out"
+fi
+EOF
+    chmod +x $DIR/bin/$tool
+done
+
+# Count the tokens that are available in the jobserver, by taking all of
+# them and giving them back.
+cat > $DIR/free-tokens.py <<'EOF'
+import os, re
+auth = re.findall(r'--jobserver-(?:auth|fds)=(\S+)', os.environ['MAKEFLAGS'])[-1]
+if auth.startswith('fifo:'):
+    rfd = wfd = os.open(auth[5:], os.O_RDWR | os.O_NONBLOCK)
+else:
+    r, wfd = map(int, auth.split(','))
+    rfd = os.open('/proc/self/fd/%d' % r, os.O_RDONLY | os.O_NONBLOCK)
+tokens = b''
+try:
+    while True:
+        token = os.read(rfd, 1)
+        if not token:
+            break
+        tokens += token
+except BlockingIOError:
+    pass
+os.write(wfd, tokens)
+print(len(tokens))
+EOF
+
+cat > $DIR/Makefile <<'EOF'
+CC = bin/x86_64-w64-mingw32-clang
+LD = bin/x86_64-w64-mingw32-ld
+OBJS = 1 2 3 4 5 6
+LINKS = 1 2 3 4
+
+all: $(OBJS:%=obj%.stamp) $(OBJS:%=pobj%.stamp) $(LINKS:%=clang%.exe) $(LINKS:%=ld%.exe)
+
+obj%.stamp:
+	cd src$* && ../$(CC) -c a.c b.c c.c d.c e.c f.c
+	touch $@
+
+pobj%.stamp:
+	+cd src$* && ../$(CC) -c a.c b.c c.c d.c e.c f.c
+	touch $@
+
+clang%.exe:
+	+$(CC) src1/a.o -o $@
+
+ld%.exe:
+	+$(LD) src1/a.o -o $@
+
+cached.exe:
+	+$(CC) src1/a.o -o $@
+EOF
+for i in 1 2 3 4 5 6; do
+    mkdir -p $DIR/src$i
+    touch $DIR/src$i/a.c $DIR/src$i/b.c $DIR/src$i/c.c $DIR/src$i/d.c $DIR/src$i/e.c $DIR/src$i/f.c
+done
+
+cd $DIR
+unset LLVM_MINGW_OBJCACHE LLVM_MINGW_DRIVER_CACHE LLVM_MINGW_LINK_CACHE
+# Without the jobserver, each compile would run 6 compiles in parallel,
+# and each link would use all CPUs.
+LLVM_MINGW_JOBS=6 LLVM_MINGW_LINK_JOBSERVER=1 make -j$JOBS > /dev/null
+
+max=$(sort -n threads.log | tail -1)
+echo "At most $max threads running with make -j$JOBS"
+if [ $max -gt $JOBS ] || [ $max -lt 2 ]; then
+    exit 1
+fi
+
+# A cached link through clang runs the ld wrapper, which must not take
+# more tokens than the clang wrapper already holds for the link. Allow
+# more jobs than CPUs, to have tokens left over.
+JOBS=$(($(getconf _NPROCESSORS_ONLN) + 2))
+touch src1/a.o
+LLVM_MINGW_OBJCACHE=$DIR/cache LLVM_MINGW_LINK_CACHE=1 \
+    LLVM_MINGW_LINK_JOBSERVER=1 FREE_TOKENS_LOG=$DIR/tokens.log \
+    make -j$JOBS cached.exe > /dev/null
+
+read threads free < tokens.log
+echo "Cached link used $threads threads, with $free of $JOBS tokens left"
+if [ $((threads + free)) -ne $JOBS ]; then
+    exit 1
+fi
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+
+# Aggregate the -ftime-trace files collected by the clang wrapper with
+# LLVM_MINGW_TIME_TRACE=dir, ranking the headers, template instantiations
+# and compiler phases that take the most time across a whole build.
+
+import argparse
+import glob
+import json
+import os
+import re
+import sys
+
+
+class Stat:
+    def __init__(self):
+        self.total = 0
+        self.self_time = 0
+        self.count = 0
+        self.tus = set()
+
+    def add(self, dur, tu):
+        self.total += dur
+        self.count += 1
+        self.tus.add(tu)
+
+
+def header_group(path):
+    path = path.replace("\\", "/")
+    if "/include/c++/" in path:
+        return "libc++"
+    if re.search(r"/[^/]+-w64-mingw32/include/", path):
+        return "mingw-w64"
+    if re.search(r"/lib/clang/[^/]+/include/", path):
+        return "clang"
+    return "other"
+
+
+def process_trace(path, tu, target, headers, templates, phases, groups):
+    with open(path) as f:
+        try:
+            events = json.load(f)["traceEvents"]
+        except (ValueError, KeyError):
+            print("Unable to parse %s" % path, file=sys.stderr)
+            return
+    events = [e for e in events if e.get("ph") == "X"]
+
+    # Source events nest as headers include each other; compute the self
+    # time of each by subtracting the time of the directly nested ones.
+    sources = sorted((e for e in events if e["name"] == "Source"),
+                     key=lambda e: (e["ts"], -e["dur"]))
+    stack = []
+    for e in sources:
+        while stack and stack[-1]["ts"] + stack[-1]["dur"] <= e["ts"]:
+            stack.pop()
+        header = e["args"]["detail"]
+        stat = headers.setdefault(header, Stat())
+        stat.add(e["dur"], tu)
+        stat.self_time += e["dur"]
+        if stack:
+            headers[stack[-1]["args"]["detail"]].self_time -= e["dur"]
+        else:
+            groups.setdefault((target, header_group(header)), Stat()).add(
+                e["dur"], tu)
+        stack.append(e)
+
+    for e in events:
+        name = e["name"]
+        if name in ("InstantiateClass", "InstantiateFunction"):
+            detail = e.get("args", {}).get("detail", "")
+            templates.setdefault((name, detail), Stat()).add(e["dur"], tu)
+        elif name.startswith("Total "):
+            phases.setdefault((target, name[6:]), Stat()).add(e["dur"], tu)
+
+
+def ms(us):
+    return us / 1000.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=
+        "Summarize the traces collected with LLVM_MINGW_TIME_TRACE=dir.")
+    parser.add_argument("dir", help="the LLVM_MINGW_TIME_TRACE directory")
+    parser.add_argument("-n", "--top", type=int, default=30,
+                        help="number of entries to list (default 30)")
+    parser.add_argument("-t", "--target",
+                        help="only include traces for this target")
+    args = parser.parse_args()
+
+    headers, templates, phases, groups = {}, {}, {}, {}
+    files = sorted(glob.glob(os.path.join(args.dir, "*", "*.json")))
+    nb_tus = 0
+    for path in files:
+        target = os.path.basename(os.path.dirname(path))
+        if args.target and target != args.target:
+            continue
+        tu = "%s/%s" % (target, os.path.basename(path))
+        process_trace(path, tu, target, headers, templates, phases, groups)
+        nb_tus += 1
+    if not nb_tus:
+        print("No traces in %s" % args.dir, file=sys.stderr)
+        return 1
+    print("%d translation units" % nb_tus)
+
+    print()
+    print("Compiler phases (total ms, count):")
+    for (target, name), stat in sorted(phases.items(),
+                                       key=lambda x: -x[1].total):
+        print("%12.0f %8d  %-24s %s" %
+              (ms(stat.total), stat.count, target, name))
+
+    print()
+    print("Time in directly included headers, by origin (ms, TUs):")
+    for (target, group), stat in sorted(groups.items(),
+                                        key=lambda x: -x[1].total):
+        print("%12.0f %8d  %-24s %s" %
+              (ms(stat.total), len(stat.tus), target, group))
+
+    print()
+    print("Most expensive headers, including what they include "
+          "(ms, self ms, TUs):")
+    for header, stat in sorted(headers.items(),
+                               key=lambda x: -x[1].total)[:args.top]:
+        print("%12.0f %10.0f %6d  %s" %
+              (ms(stat.total), ms(stat.self_time), len(stat.tus), header))
+
+    print()
+    print("Most expensive headers by themselves (self ms, TUs):")
+    for header, stat in sorted(headers.items(),
+                               key=lambda x: -x[1].self_time)[:args.top]:
+        print("%12.0f %6d  %s" % (ms(stat.self_time), len(stat.tus), header))
+
+    print()
+    print("Most expensive template instantiations (ms, count):")
+    for (kind, name), stat in sorted(templates.items(),
+                                     key=lambda x: -x[1].total)[:args.top]:
+        print("%12.0f %8d  %s %s" %
+              (ms(stat.total), stat.count, kind[len("Instantiate"):], name))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
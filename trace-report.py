@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+
+# Merge the events written by the wrappers with LLVM_MINGW_TRACE=dir into
+# a Chrome trace (for chrome://tracing or ui.perfetto.dev), and print a
+# summary per target and tool, and the slowest and largest invocations.
+
+import argparse
+import json
+import os
+import sys
+
+
+def read_events(dir):
+    events = []
+    with open(os.path.join(dir, "events.jsonl")) as f:
+        for line in f:
+            try:
+                events.append(json.loads(line))
+            except ValueError:
+                # A partially written line, from an interrupted tool.
+                pass
+    return events
+
+
+def describe(event):
+    # The output file is usually the most telling part of the command.
+    argv = event["args"]["argv"]
+    for i, arg in enumerate(argv[:-1]):
+        if arg in ("-o", "-fo"):
+            return argv[i + 1]
+    # Otherwise the last argument that isn't an option.
+    for arg in reversed(argv[1:]):
+        if not arg.startswith("-"):
+            return arg
+    return " ".join(argv[1:])[:80]
+
+
+def write_chrome_trace(events, path):
+    # One process per target, and the invocations packed into as few
+    # threads (lanes) as possible, so that they don't overlap.
+    targets = sorted(set(e["cat"] for e in events))
+    start = min(e["ts"] for e in events)
+    out = []
+    for pid, target in enumerate(targets, 1):
+        out.append({"name": "process_name", "ph": "M", "pid": pid,
+                    "args": {"name": target}})
+        lanes = []
+        for e in sorted((e for e in events if e["cat"] == target),
+                        key=lambda e: e["ts"]):
+            for tid, end in enumerate(lanes):
+                if end <= e["ts"]:
+                    break
+            else:
+                tid = len(lanes)
+                lanes.append(0)
+            lanes[tid] = e["ts"] + e["dur"]
+            e = dict(e, ts=e["ts"] - start, pid=pid, tid=tid + 1)
+            e["name"] = "%s %s" % (e["name"], describe(e))
+            out.append(e)
+    with open(path, "w") as f:
+        json.dump({"traceEvents": out, "displayTimeUnit": "ms"}, f)
+
+
+def print_report(events, top):
+    totals = {}
+    for e in events:
+        t = totals.setdefault((e["cat"], e["name"]), [0, 0, 0, 0])
+        t[0] += 1
+        t[1] += e["dur"]
+        t[2] += e["args"]["user_us"] + e["args"]["sys_us"]
+        t[3] = max(t[3], e["args"]["maxrss_kb"])
+    wall = (max(e["ts"] + e["dur"] for e in events) -
+            min(e["ts"] for e in events))
+    print("Total wall time: %.1f s, %d invocations" % (wall / 1e6, len(events)))
+    print()
+    print("%-24s %-16s %6s %10s %10s %10s" %
+          ("target", "tool", "count", "wall s", "cpu s", "max MB"))
+    for (target, name), t in sorted(totals.items(), key=lambda x: -x[1][2]):
+        print("%-24s %-16s %6d %10.1f %10.1f %10.1f" %
+              (target, name, t[0], t[1] / 1e6, t[2] / 1e6, t[3] / 1024))
+
+    print()
+    print("Slowest invocations:")
+    for e in sorted(events, key=lambda e: -e["dur"])[:top]:
+        print("%8.2f s  %-24s %-12s %s" %
+              (e["dur"] / 1e6, e["cat"], e["name"], describe(e)))
+
+    print()
+    print("Largest peak memory:")
+    for e in sorted(events, key=lambda e: -e["args"]["maxrss_kb"])[:top]:
+        print("%8.1f MB %-24s %-12s %s" %
+              (e["args"]["maxrss_kb"] / 1024, e["cat"], e["name"],
+               describe(e)))
+
+    failed = [e for e in events if e["args"]["exit"] != 0]
+    if failed:
+        print()
+        print("%d invocations failed" % len(failed))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=
+        "Summarize the events written with LLVM_MINGW_TRACE=dir.")
+    parser.add_argument("dir", help="the LLVM_MINGW_TRACE directory")
+    parser.add_argument("-n", "--top", type=int, default=20,
+                        help="number of invocations to list (default 20)")
+    parser.add_argument("-o", "--output",
+                        help="Chrome trace to write (default dir/trace.json)")
+    args = parser.parse_args()
+
+    events = read_events(args.dir)
+    if not events:
+        print("No events in %s" % args.dir, file=sys.stderr)
+        return 1
+    output = args.output or os.path.join(args.dir, "trace.json")
+    write_chrome_trace(events, output)
+    print_report(events, args.top)
+    print()
+    print("Wrote %s" % output)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
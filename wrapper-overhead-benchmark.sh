@@ -0,0 +1,77 @@
+#!/bin/sh
+
+# Time many trivial invocations of the <arch>-w64-mingw32-clang and
+# <arch>-w64-mingw32-ld frontends in a toolchain, e.g.
+#   ./wrapper-overhead-benchmark.sh /opt/llvm-mingw x86_64 1000
+# comparing the native wrappers with shell script frontends doing what
+# the old wrapper scripts did (locating their own directory and target
+# with dirname and basename, extending PATH), and with running the tools
+# directly. The difference to the direct runs is the time spent in the
+# wrapper itself, per invocation.
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo $0 prefix [arch] [iterations]
+    exit 1
+fi
+PREFIX="$(cd "$1" && pwd)"
+ARCH="${2:-x86_64}"
+NB="${3:-1000}"
+
+DIR=$(mktemp -d)
+trap "rm -rf $DIR" EXIT
+
+case $ARCH in
+i686)    M=i386pe   ;;
+x86_64)  M=i386pep  ;;
+armv7)   M=thumb2pe ;;
+aarch64) M=arm64pe  ;;
+esac
+
+cat > $DIR/$ARCH-w64-mingw32-clang <<EOF
+#!/bin/sh
+DIR="\$(cd "\$(dirname "\$0")" && pwd)"
+BASENAME="\$(basename "\$0")"
+TARGET="\${BASENAME%-*}"
+export PATH=$PREFIX/bin:\$PATH
+$PREFIX/bin/clang -target \$TARGET -rtlib=compiler-rt -stdlib=libc++ -fuse-ld=lld -fuse-cxa-atexit -Qunused-arguments "\$@"
+EOF
+cat > $DIR/$ARCH-w64-mingw32-ld <<EOF
+#!/bin/sh
+DIR="\$(cd "\$(dirname "\$0")" && pwd)"
+BASENAME="\$(basename "\$0")"
+TARGET="\${BASENAME%-*}"
+export PATH=$PREFIX/bin:\$PATH
+ld.lld -m $M "\$@"
+EOF
+chmod +x $DIR/$ARCH-w64-mingw32-clang $DIR/$ARCH-w64-mingw32-ld
+
+run() {
+    desc="$1"
+    shift
+    i=0
+    start=$(date +%s%N)
+    while [ $i -lt $NB ]; do
+        "$@" > /dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    time=$(( (end - start) / NB / 1000 ))
+    if [ -z "$direct" ]; then
+        direct=$time
+        echo "$desc $time us"
+    else
+        echo "$desc $time us (+$((time - direct)) us)"
+    fi
+}
+
+echo "$NB invocations each, time per invocation:"
+direct=
+run "clang --version, direct:" $PREFIX/bin/clang --version
+run "clang --version, native:" $PREFIX/bin/$ARCH-w64-mingw32-clang --version
+run "clang --version, shell: " $DIR/$ARCH-w64-mingw32-clang --version
+direct=
+run "ld -v, direct:          " $PREFIX/bin/ld.lld -v
+run "ld -v, native:          " $PREFIX/bin/$ARCH-w64-mingw32-ld -v
+run "ld -v, shell:           " $DIR/$ARCH-w64-mingw32-ld -v
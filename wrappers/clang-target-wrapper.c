@@ -16,100 +16,11 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#ifdef UNICODE
-#define _UNICODE
-#endif
-
 #ifndef CLANG
 #define CLANG "clang"
 #endif
-#ifndef DEFAULT_TARGET
-#define DEFAULT_TARGET "x86_64-w64-mingw32"
-#endif
-
-#include <stdio.h>
-#include <string.h>
-#include <stdlib.h>
-
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include <tchar.h>
-#include <windows.h>
-#include <process.h>
-#define EXECVP_CAST
-#else
-#include <unistd.h>
-typedef char TCHAR;
-#define _T(x) x
-#define _tcsrchr strrchr
-#define _tcschr strchr
-#define _tcsdup strdup
-#define _tcscpy strcpy
-#define _tcslen strlen
-#define _tcscmp strcmp
-#define _tperror perror
-#define _texecvp execvp
-#define _tmain main
-#define EXECVP_CAST (char **)
-#endif
-
-#ifdef _UNICODE
-#define TS "%ls"
-#else
-#define TS "%s"
-#endif
 
-static TCHAR *escape(const TCHAR *str) {
-#ifdef _WIN32
-    TCHAR *out = malloc((_tcslen(str) * 2 + 3) * sizeof(*out));
-    TCHAR *ptr = out;
-    int i;
-    *ptr++ = '"';
-    for (i = 0; str[i]; i++) {
-        if (str[i] == '"') {
-            int j = i - 1;
-            // Before all double quotes, backslashes need to be escaped, but
-            // not elsewhere.
-            while (j >= 0 && str[j--] == '\\')
-                *ptr++ = '\\';
-            // Escape the next double quote.
-            *ptr++ = '\\';
-        }
-        *ptr++ = str[i];
-    }
-    // Any final backslashes, before the quote around the whole argument,
-    // need to be doubled.
-    int j = i - 1;
-    while (j >= 0 && str[j--] == '\\')
-        *ptr++ = '\\';
-    *ptr++ = '"';
-    *ptr++ = '\0';
-    return out;
-#else
-    return _tcsdup(str);
-#endif
-}
-
-static TCHAR *concat(const TCHAR *prefix, const TCHAR *suffix) {
-    int prefixlen = _tcslen(prefix);
-    int suffixlen = _tcslen(suffix);
-    TCHAR *buf = malloc((prefixlen + suffixlen + 1) * sizeof(*buf));
-    _tcscpy(buf, prefix);
-    _tcscpy(buf + prefixlen, suffix);
-    return buf;
-}
-
-static TCHAR *_tcsrchrs(const TCHAR *str, TCHAR char1, TCHAR char2) {
-    TCHAR *ptr1 = _tcsrchr(str, char1);
-    TCHAR *ptr2 = _tcsrchr(str, char2);
-    if (!ptr1)
-        return ptr2;
-    if (!ptr2)
-        return ptr1;
-    if (ptr1 < ptr2)
-        return ptr2;
-    return ptr1;
-}
+#include "native-wrapper.h"
 
 #ifdef _WIN32
 static int filter_line = 0, last_char = '\n';
@@ -219,44 +130,1842 @@ static int exec_filtered(const TCHAR **argv) {
     free(cmdline);
     return exit_code;
 }
-#endif
+#else
+// Driver invocation cache, enabled by setting LLVM_MINGW_DRIVER_CACHE to
+// a directory. For plain "-c" compiles of one single source file, the
+// "-cc1" command that the clang driver would run (as printed by "-###")
+// is stored on disk, with the input and output file names replaced by
+// placeholders. On a cache hit, the "-cc1" command is executed directly,
+// skipping the driver. Anything that could make the expansion depend on
+// more than what is included in the cache key makes us fall back to
+// running the driver as usual.
 
-int _tmain(int argc, TCHAR* argv[]) {
-    const TCHAR *argv0 = argv[0];
-    const TCHAR *sep = _tcsrchrs(argv0, '/', '\\');
-    TCHAR *dir = _tcsdup(_T(""));
-    const TCHAR *basename = argv0;
-    if (sep) {
-        dir = _tcsdup(argv0);
-        dir[sep + 1 - argv0] = '\0';
-        basename = sep + 1;
+#define CACHE_INPUT "\001input"
+#define CACHE_OUTPUT "\001output"
+#define CACHE_MAIN_FILE "\001main-file"
+
+static int starts_with_any(const char *str, const char *const *prefixes) {
+    for (int i = 0; prefixes[i]; i++)
+        if (!strncmp(str, prefixes[i], strlen(prefixes[i])))
+            return 1;
+    return 0;
+}
+
+static int equals_any(const char *str, const char *const *list) {
+    for (int i = 0; list[i]; i++)
+        if (!strcmp(str, list[i]))
+            return 1;
+    return 0;
+}
+
+// Options that take their value as a separate argument, which therefore
+// can't be mistaken for an input file.
+static const char *const separate_arg_options[] = {
+    "-o", "-x", "-I", "-D", "-U", "-L", "-l", "-u", "-T", "-z", "-F",
+    "-include", "-imacros", "-include-pch", "-isystem", "-isysroot",
+    "-iquote", "-idirafter", "-iprefix", "-iwithprefix",
+    "-iwithprefixbefore", "-ivfsoverlay", "-MF", "-MT", "-MQ",
+    "-Xclang", "-Xpreprocessor", "-Xassembler", "-Xlinker", "-mllvm",
+    "-target", "--sysroot", "-arch", "--param", NULL
+};
+
+// Options (matched as prefixes) that make the driver do something else
+// than a single compile, or that make the "-cc1" command refer to further
+// files named after the input or output, which we can't substitute.
+static const char *const uncacheable_options[] = {
+    "-M", "-Wp,", "-Wa,", "-E", "-S", "-v", "-###", "-save-temps",
+    "-fsyntax-only", "--coverage", "-ftest-coverage", "-fprofile-arcs",
+    "-gsplit-dwarf", "-grecord", "-ftime-trace", "-fsave-optimization-record",
+    "-working-directory", "-fcrash-diagnostics", "@", NULL
+};
+
+static const char *const color_options[] = {
+    "-fcolor-diagnostics", "-fno-color-diagnostics", "-fdiagnostics-color",
+    NULL
+};
+
+// Environment variables that affect the driver's expansion.
+static const char *const cache_env_vars[] = {
+    "CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH", "OBJC_INCLUDE_PATH",
+    "OBJCPLUS_INCLUDE_PATH", "CCC_OVERRIDE_OPTIONS", NULL
+};
+
+// Dependency file options (-MD, -MMD, -MP, -MF, -MT, -MQ, and
+// -Wp,-MD,<file> as passed by autotools' depcomp), which the object cache
+// handles itself.
+struct dep_options {
+    int mode;          // 0, or the option used: 'D' for -MD, 'M' for -MMD
+    int phony;         // -MP
+    const char *file;  // -MF
+    struct buf targets;
+};
+
+// Quote a target for make, like -MQ does.
+static void quote_target(struct buf *out, const char *target) {
+    for (const char *ptr = target; *ptr; ptr++) {
+        if (*ptr == ' ' || *ptr == '\t' || *ptr == '#')
+            buf_append(out, "\\", 1);
+        else if (*ptr == '$')
+            buf_append(out, "$", 1);
+        buf_append(out, ptr, 1);
     }
-#ifdef _WIN32
-    TCHAR module_path[8192];
-    GetModuleFileName(NULL, module_path, sizeof(module_path)/sizeof(module_path[0]));
-    TCHAR *sep2 = _tcsrchr(module_path, '\\');
-    if (sep2) {
-        sep2[1] = '\0';
-        dir = _tcsdup(module_path);
+}
+
+// Parse a dependency file option at argv[*i] (and its value) into deps.
+// Returns 1 if it was one.
+static int parse_dep_option(int argc, char **argv, int *i,
+                            struct dep_options *deps) {
+    const char *arg = argv[*i];
+    if (!strcmp(arg, "-MD") || !strcmp(arg, "-MMD")) {
+        deps->mode = arg[2];
+        return 1;
     }
-#endif
-    basename = _tcsdup(basename);
-    TCHAR *period = _tcschr(basename, '.');
-    if (period)
-        *period = '\0';
-    TCHAR *dash = _tcsrchr(basename, '-');
-    const TCHAR *target = basename;
-    const TCHAR *exe = basename;
-    if (dash) {
-        *dash = '\0';
-        exe = dash + 1;
+    if (!strcmp(arg, "-MP")) {
+        deps->phony = 1;
+        return 1;
+    }
+    if (!strncmp(arg, "-Wp,-MD,", 8) || !strncmp(arg, "-Wp,-MMD,", 9)) {
+        deps->mode = arg[6];
+        deps->file = strchr(arg + 4, ',') + 1;
+        return 1;
+    }
+    if (strncmp(arg, "-MF", 3) && strncmp(arg, "-MT", 3) &&
+        strncmp(arg, "-MQ", 3))
+        return 0;
+    const char *value = arg + 3;
+    if (!*value) {
+        if (*i + 1 >= argc)
+            return 0;
+        value = argv[++*i];
+    }
+    if (arg[2] == 'F') {
+        deps->file = value;
+        return 1;
+    }
+    if (deps->targets.len)
+        buf_append(&deps->targets, " ", 1);
+    if (arg[2] == 'Q')
+        quote_target(&deps->targets, value);
+    else
+        buf_append(&deps->targets, value, strlen(value));
+    return 1;
+}
+
+// Check whether the user's arguments are a plain "-c" compile of a single
+// source file with an explicit "-o" output, and locate those arguments.
+// If deps is set, dependency file options are accepted, and parsed into
+// it, with the arguments they take up marked in dep_args.
+static int find_cacheable_input(int argc, char **argv, int *input,
+                                int *output, int *color,
+                                struct dep_options *deps, char *dep_args) {
+    int compile = 0;
+    *input = *output = -1;
+    *color = 0;
+    for (int i = 1; i < argc; i++) {
+        int start = i;
+        if (deps && parse_dep_option(argc, argv, &i, deps)) {
+            for (; start <= i; start++)
+                dep_args[start] = 1;
+        } else if (!strcmp(argv[i], "-c")) {
+            compile = 1;
+        } else if (!strcmp(argv[i], "-o")) {
+            if (i + 1 >= argc)
+                return 0;
+            *output = ++i;
+        } else if (starts_with_any(argv[i], uncacheable_options) ||
+                   !strcmp(argv[i], "-")) {
+            return 0;
+        } else if (equals_any(argv[i], separate_arg_options)) {
+            i++;
+        } else if (argv[i][0] != '-') {
+            if (*input >= 0)
+                return 0;
+            *input = i;
+        } else if (starts_with_any(argv[i], color_options)) {
+            *color = 1;
+        }
+    }
+    return compile && *input >= 0 && *output >= 0;
+}
+
+// Build the cache key from the identity of the clang binary and the
+// toolchain prefix, the working directory, the relevant environment, and
+// the final command line with the input and output replaced. Returns the
+// resolved path of clang, or NULL if we can't cache this invocation.
+static char *build_cache_key(struct buf *key, const char **exec_argv,
+                             const char *input, int input_arg,
+                             int output_arg) {
+    char *clang = find_in_path(exec_argv[0]);
+    char *real = clang ? realpath(clang, NULL) : NULL;
+    free(clang);
+    if (!real)
+        return NULL;
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        free(real);
+        return NULL;
+    }
+
+    buf_append_token(key, "llvm-mingw-driver-cache-1");
+    buf_append_token(key, real);
+    append_stat_token(key, real);
+    char *prefix = strdup(real);
+    for (int i = 0; i < 2; i++) {
+        char *sep = strrchr(prefix, '/');
+        if (sep && sep != prefix)
+            *sep = '\0';
+    }
+    buf_append_token(key, prefix);
+    append_stat_token(key, prefix);
+    free(prefix);
+    buf_append_token(key, cwd);
+    for (int i = 0; cache_env_vars[i]; i++) {
+        const char *value = getenv(cache_env_vars[i]);
+        buf_append(key, cache_env_vars[i], strlen(cache_env_vars[i]));
+        if (value) {
+            buf_append(key, "=", 1);
+            buf_append(key, value, strlen(value));
+        }
+        buf_append(key, "", 1);
+    }
+    // The language is inferred from the extension of the input file.
+    const char *ext = strrchr(input, '.');
+    buf_append_token(key, ext && !strchr(ext, '/') ? ext : "");
+    for (int i = 1; exec_argv[i]; i++) {
+        if (i == input_arg)
+            buf_append_token(key, CACHE_INPUT);
+        else if (i == output_arg)
+            buf_append_token(key, CACHE_OUTPUT);
+        else
+            buf_append_token(key, exec_argv[i]);
+    }
+    // Terminate the key with an empty token.
+    buf_append(key, "", 1);
+    return real;
+}
+
+static char *cache_entry_path(const char *cache_dir, const struct buf *key) {
+    // FNV-1a; the full key is stored in the entry and compared on lookup,
+    // so collisions only cause cache misses.
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < key->len; i++) {
+        hash ^= (unsigned char) key->data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    char *path = malloc(strlen(cache_dir) + 40);
+    sprintf(path, "%s/%016llx", cache_dir, hash);
+    return path;
+}
+
+// Parse the output of "-###" into the arguments of its only job. Fails if
+// there are several jobs, or any output (like diagnostics) apart from the
+// version banner, which a cached expansion wouldn't reproduce.
+static char **parse_driver_job(char *text) {
+    static const char *const banner[] = {
+        "clang version ", "Target: ", "Thread model: ", "InstalledDir: ",
+        " (in-process)", NULL
+    };
+    char **job = NULL;
+    char *line = text;
+    while (*line) {
+        char *end = strchr(line, '\n');
+        if (end)
+            *end = '\0';
+        if (starts_with_any(line, banner)) {
+            // Ignore
+        } else if (line[0] == ' ' && line[1] == '"' && !job) {
+            int n = 0;
+            job = malloc((strlen(line) / 2 + 2) * sizeof(*job));
+            char *in = line, *out = line;
+            while (*in == ' ') {
+                in++;
+                if (*in++ != '"') {
+                    free(job);
+                    return NULL;
+                }
+                job[n++] = out;
+                while (*in && *in != '"') {
+                    if (*in == '\\' && in[1])
+                        in++;
+                    *out++ = *in++;
+                }
+                if (*in++ != '"') {
+                    free(job);
+                    return NULL;
+                }
+                *out++ = '\0';
+            }
+            job[n] = NULL;
+            if (n < 2 || (strcmp(job[1], "-cc1") && strcmp(job[1], "-cc1as"))) {
+                free(job);
+                return NULL;
+            }
+        } else if (line[0] != '\0') {
+            free(job);
+            return NULL;
+        }
+        if (!end)
+            break;
+        line = end + 1;
+    }
+    return job;
+}
+
+static void write_cache_entry(const char *cache_dir, const char *path,
+                              const struct buf *key, const char **job,
+                              const char *input, const char *output) {
+    const char *base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    struct buf entry = { 0 };
+    buf_append(&entry, key->data, key->len);
+    for (int i = 0; job[i]; i++) {
+        const char *token = job[i];
+        if (i > 0 && !strcmp(job[i - 1], "-main-file-name") &&
+            !strcmp(token, base))
+            token = CACHE_MAIN_FILE;
+        else if (!strcmp(token, input))
+            token = CACHE_INPUT;
+        else if (i > 0 && !strcmp(job[i - 1], "-o") && !strcmp(token, output))
+            token = CACHE_OUTPUT;
+        else if (strstr(token, input) || strstr(token, output)) {
+            // Some other argument derived from the file names.
+            free(entry.data);
+            return;
+        }
+        buf_append_token(&entry, token);
+    }
+
+    mkdir(cache_dir, 0777);
+    char *tmp = malloc(strlen(path) + 30);
+    sprintf(tmp, "%s.%d.tmp", path, (int) getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd >= 0) {
+        int ok = write(fd, entry.data, entry.len) == (ssize_t) entry.len;
+        if (close(fd) || !ok || rename(tmp, path))
+            unlink(tmp);
+    }
+    free(tmp);
+    free(entry.data);
+}
+
+// Try to run the compile through the driver cache. Only returns if the
+// invocation can't be handled, and the driver should be run as usual.
+static void try_driver_cache(const char *cache_dir, int argc, char **argv,
+                             const char **exec_argv, int user_args) {
+    int input, output, color;
+    if (!find_cacheable_input(argc, argv, &input, &output, &color, NULL,
+                              NULL))
+        return;
+    // The driver enables colors itself if stderr is a terminal, which
+    // doesn't show up when capturing the "-###" output.
+    if (!color && isatty(2))
+        return;
+    const char *input_path = argv[input], *output_path = argv[output];
+    struct buf key = { 0 };
+    char *clang = build_cache_key(&key, exec_argv, input_path,
+                                  user_args + input - 1,
+                                  user_args + output - 1);
+    if (!clang)
+        return;
+    free(clang);
+    char *path = cache_entry_path(cache_dir, &key);
+
+    struct buf entry = { 0 };
+    if (!read_file(path, &entry) && entry.len > key.len &&
+        !memcmp(entry.data, key.data, key.len) &&
+        entry.data[entry.len - 1] == '\0') {
+        const char *base = strrchr(input_path, '/');
+        base = base ? base + 1 : input_path;
+        const char **job = malloc((entry.len - key.len + 1) * sizeof(*job));
+        int n = 0;
+        for (size_t pos = key.len; pos < entry.len; pos += strlen(entry.data + pos) + 1) {
+            const char *token = entry.data + pos;
+            if (!strcmp(token, CACHE_INPUT))
+                token = input_path;
+            else if (!strcmp(token, CACHE_OUTPUT))
+                token = output_path;
+            else if (!strcmp(token, CACHE_MAIN_FILE))
+                token = base;
+            job[n++] = token;
+        }
+        job[n] = NULL;
+        execv(job[0], (char **) job);
+        // If the cached command can't be executed, fall back to the driver.
+        free(job);
+        free(entry.data);
+        free(path);
+        free(key.data);
+        return;
+    }
+    free(entry.data);
+
+    int nargs = 0;
+    while (exec_argv[nargs])
+        nargs++;
+    const char **query = malloc((nargs + 2) * sizeof(*query));
+    memcpy(query, exec_argv, nargs * sizeof(*query));
+    query[nargs] = "-###";
+    query[nargs + 1] = NULL;
+    struct buf out = { 0 };
+    char **job = NULL;
+    if (capture_stderr(query, 1, &out) == 0 && out.data)
+        job = parse_driver_job(out.data);
+    if (job) {
+        write_cache_entry(cache_dir, path, &key, (const char **) job,
+                          input_path, output_path);
+        execv(job[0], job);
+    }
+    free(job);
+    free(out.data);
+    free(query);
+    free(path);
+    free(key.data);
+}
+
+// Object cache, enabled by setting LLVM_MINGW_OBJCACHE to a directory.
+// For the same kind of single source "-c" compiles as the driver cache
+// above, the output object is stored under a hash of the preprocessed
+// source, the final command line and the identity of the compiler. Hits
+// copy the object (and replay any diagnostics) without compiling. The
+// store itself is in native-wrapper.h.
+//
+// Compiles that also write a dependency file (-MD and so on, as used by
+// CMake and autotools) are cached as well: the dependency file is stored
+// with its targets stripped, and written on a hit with the targets of
+// the current compile (the -MT/-MQ values, or the object file). Its name
+// and targets are left out of the key; the headers it lists are part of
+// the preprocessed source.
+
+// Hash the compiler identity, the command line (apart from the output
+// name and the arguments marked in skip) and the preprocessed source.
+// Returns 0 on success.
+static int hash_compile(const char **exec_argv, int output_arg,
+                        const char *skip, const struct dep_options *deps,
+                        char *hash) {
+    struct sha256 sha;
+    struct buf key = { 0 };
+    char *clang = find_in_path(exec_argv[0]);
+    char *real = clang ? realpath(clang, NULL) : NULL;
+    free(clang);
+    char cwd[4096];
+    if (!real || !getcwd(cwd, sizeof(cwd))) {
+        free(real);
+        return -1;
+    }
+    buf_append_token(&key, "llvm-mingw-objcache-1");
+    buf_append_token(&key, real);
+    append_stat_token(&key, real);
+    // The preprocessed output doesn't include what comes from a PCH.
+    for (int i = 0; exec_argv[i]; i++)
+        if (!strcmp(exec_argv[i], "-include-pch") && exec_argv[i + 1])
+            append_stat_token(&key, exec_argv[i + 1]);
+    // The working directory ends up in debug info.
+    buf_append_token(&key, cwd);
+    for (int i = 0; cache_env_vars[i]; i++) {
+        const char *value = getenv(cache_env_vars[i]);
+        buf_append_token(&key, value ? value : "");
+    }
+    char dep_mode[3] = { deps->mode, deps->phony ? 'P' : '-', '\0' };
+    buf_append_token(&key, dep_mode);
+
+    int nargs = 0;
+    while (exec_argv[nargs])
+        nargs++;
+    const char **preproc = malloc((nargs + 2) * sizeof(*preproc));
+    int n = 0;
+    for (int i = 0; i < nargs; i++) {
+        if (i == output_arg - 1 || i == output_arg || skip[i])
+            continue;
+        if (i > 0)
+            buf_append_token(&key, exec_argv[i]);
+        if (!strcmp(exec_argv[i], "-c"))
+            continue;
+        preproc[n++] = exec_argv[i];
+    }
+    preproc[n++] = "-E";
+    preproc[n] = NULL;
+
+    sha256_init(&sha);
+    sha256_update(&sha, key.data, key.len);
+    free(key.data);
+    free(real);
+
+    int fd;
+    pid_t pid = spawn_piped(preproc, 1, 2, &fd);
+    free(preproc);
+    if (pid < 0)
+        return -1;
+    char block[65536];
+    ssize_t len;
+    while ((len = read(fd, block, sizeof(block))) != 0) {
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+            break;
+        sha256_update(&sha, block, len);
+    }
+    close(fd);
+    if (wait_child(pid) != 0)
+        return -1;
+    sha256_final(&sha, hash);
+    return 0;
+}
+
+// The name of the dependency file that clang writes for -MD without -MF:
+// the output file with its extension replaced by .d.
+static char *default_dep_file(const char *output) {
+    char *path = malloc(strlen(output) + 3);
+    strcpy(path, output);
+    char *ext = strrchr(path, '.');
+    if (ext && !strchr(ext, '/'))
+        *ext = '\0';
+    strcat(path, ".d");
+    return path;
+}
+
+// Strip the targets from the dependency file in deps, leaving the text
+// from the colon that follows them. Returns 0 on success.
+static int strip_dep_targets(struct buf *deps) {
+    for (size_t i = 0; i < deps->len; i++) {
+        if (deps->data[i] != ':')
+            continue;
+        if (i + 1 < deps->len && deps->data[i + 1] != ' ' &&
+            deps->data[i + 1] != '\n')
+            continue;
+        memmove(deps->data, deps->data + i, deps->len - i);
+        deps->len -= i;
+        return 0;
+    }
+    return -1;
+}
+
+// Try to satisfy the compile from the object cache, or compile it and
+// add it to the cache. Returns the exit code of the compile, or -1 if the
+// invocation can't be cached and should be run as usual.
+static int try_objcache(const char *cache_dir, int argc, char **argv,
+                        const char **exec_argv, int user_args) {
+    int input, output, color;
+    struct dep_options deps = { 0 };
+    char *dep_args = calloc(argc, 1);
+    int cacheable = find_cacheable_input(argc, argv, &input, &output, &color,
+                                         &deps, dep_args);
+    if (!cacheable) {
+        free(dep_args);
+        free(deps.targets.data);
+        return -1;
+    }
+    const char *output_path = argv[output];
+    int output_arg = user_args + output - 1;
+
+    int nargs = 0;
+    while (exec_argv[nargs])
+        nargs++;
+    // We capture the diagnostics, so request colors explicitly if the
+    // driver would have enabled them.
+    if (!color && isatty(2)) {
+        const char *term = getenv("TERM");
+        if (term && strcmp(term, "dumb")) {
+            const char **args = malloc((nargs + 2) * sizeof(*args));
+            memcpy(args, exec_argv, nargs * sizeof(*args));
+            args[nargs] = "-fcolor-diagnostics";
+            args[nargs + 1] = NULL;
+            exec_argv = args;
+            nargs++;
+        }
+    }
+    char *skip = calloc(nargs + 1, 1);
+    for (int i = 1; i < argc; i++)
+        skip[user_args + i - 1] = dep_args[i];
+    free(dep_args);
+
+    char hash[65];
+    int ret = hash_compile(exec_argv, output_arg, skip, &deps, hash);
+    free(skip);
+    if (ret) {
+        free(deps.targets.data);
+        return -1;
+    }
+
+    char *dep_file = NULL;
+    struct buf stored = { 0 };
+    if (deps.mode) {
+        dep_file = deps.file ? strdup(deps.file)
+                             : default_dep_file(output_path);
+        if (!deps.targets.len)
+            quote_target(&deps.targets, output_path);
+    }
+
+    if (objcache_get(cache_dir, hash, ".o", output_path,
+                     deps.mode ? &stored : NULL)) {
+        ret = 0;
+        if (deps.mode) {
+            buf_append(&deps.targets, stored.data, stored.len);
+            if (write_file(dep_file, &deps.targets)) {
+                perror(dep_file);
+                ret = 1;
+            }
+        }
+    } else {
+        struct buf err = { 0 };
+        ret = capture_stderr(exec_argv, 0, &err);
+        if (err.len)
+            fwrite(err.data, 1, err.len, stderr);
+        stored.len = 0;
+        if (ret == 0 && (!deps.mode || (!read_file(dep_file, &stored) &&
+                                        !strip_dep_targets(&stored))))
+            objcache_put(cache_dir, hash, ".o", output_path, &err,
+                         deps.mode ? &stored : NULL);
+        free(err.data);
+    }
+    free(stored.data);
+    free(dep_file);
+    free(deps.targets.data);
+    return ret < 0 ? 1 : ret;
+}
+
+// Parallel compilation of multiple source files, for invocations like
+// "clang -c a.c b.c c.c", which the driver would compile one at a time.
+// Each source is compiled by rerunning this wrapper with the other
+// sources removed from the command line, so the caches above apply to
+// each of them. At most LLVM_MINGW_JOBS (by default the number of CPUs)
+// compiles run at the same time. When run by make with a jobserver, each
+// compile apart from the first one also needs a token from the jobserver.
+// The diagnostics of each compile are collected and printed in the order
+// of the sources on the command line.
+
+// Options (matched exactly) whose output would be interleaved or which
+// we can't split.
+static const char *const unsplittable_options[] = {
+    "-", "-o", "-E", "-M", "-MM", "-v", "-###", NULL
+};
+
+// Locate the inputs of a multi source "-c" compile. Returns the number
+// of inputs, or 0 if the command can't be split.
+static int find_parallel_inputs(int argc, char **argv, int *inputs) {
+    int compile = 0, nb_inputs = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-c"))
+            compile = 1;
+        else if (equals_any(argv[i], unsplittable_options) || argv[i][0] == '@')
+            return 0;
+        else if (equals_any(argv[i], separate_arg_options))
+            i++;
+        else if (argv[i][0] != '-')
+            inputs[nb_inputs++] = i;
+    }
+    return compile ? nb_inputs : 0;
+}
+
+// Options that make the driver stop before linking.
+static const char *const no_link_options[] = {
+    "-c", "-S", "-E", "-M", "-MM", "-fsyntax-only", "-###", NULL
+};
+
+static int is_link(int argc, char **argv) {
+    for (int i = 1; i < argc; i++)
+        if (equals_any(argv[i], no_link_options))
+            return 0;
+    return 1;
+}
+
+static int uses_thinlto(int argc, char **argv) {
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "-flto=thin"))
+            return 1;
+    return 0;
+}
+
+// Run a link, with the linker threads limited to the number of jobserver
+// tokens we hold (if threads > 0), and with a ThinLTO cache (if
+// lto_cache is set). Any tokens are given back afterwards.
+static int run_link(int argc, char **argv, const char **exec_argv,
+                    int nargs, int threads, const char *lto_cache) {
+    int threads_set = 0, lto_jobs_set = 0, lto_cache_set = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strstr(argv[i], "--threads"))
+            threads_set = 1;
+        else if (!strncmp(argv[i], "-flto-jobs", 10) ||
+                 strstr(argv[i], "--thinlto-jobs"))
+            lto_jobs_set = 1;
+        else if (strstr(argv[i], "--thinlto-cache-dir"))
+            lto_cache_set = 1;
+    }
+    const char **args = malloc((nargs + 7) * sizeof(*args));
+    memcpy(args, exec_argv, nargs * sizeof(*args));
+    char threads_opt[50], lto_jobs_opt[50];
+    snprintf(threads_opt, sizeof(threads_opt), "-Wl,--threads=%d", threads);
+    // Pass --thinlto-jobs to the linker directly rather than -flto-jobs,
+    // so that the ld wrapper (with --ld-path) sees that it is set.
+    snprintf(lto_jobs_opt, sizeof(lto_jobs_opt), "-Wl,--thinlto-jobs=%d",
+             threads);
+    if (threads > 0 && !threads_set)
+        args[nargs++] = threads_opt;
+    if (threads > 0 && !lto_jobs_set)
+        args[nargs++] = lto_jobs_opt;
+    char *cache_opt = NULL, *policy_opt = NULL;
+    const char *policy = getenv("LLVM_MINGW_THINLTO_CACHE_POLICY");
+    if (lto_cache && !lto_cache_set) {
+        args[nargs++] = "-Xlinker";
+        args[nargs++] = cache_opt = concat("--thinlto-cache-dir=", lto_cache);
+        if (policy && *policy) {
+            args[nargs++] = "-Xlinker";
+            args[nargs++] = policy_opt = concat("--thinlto-cache-policy=",
+                                                policy);
+        }
+    } else {
+        lto_cache = NULL;
+    }
+    args[nargs] = NULL;
+    int ret;
+    if (lto_cache) {
+        ret = run_thinlto_link(args, lto_cache);
+    } else {
+        ret = _spawnvp(_P_WAIT, args[0], args);
+        if (ret == -1) {
+            perror(args[0]);
+            ret = 1;
+        }
+    }
+    jobserver_release_all();
+    free(cache_opt);
+    free(policy_opt);
+    free(args);
+    return ret;
+}
+
+// Check if a command compiles any source files (or other inputs given a
+// language with -x), rather than only linking objects and libraries.
+static int has_source_inputs(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-x") && i + 1 < argc &&
+            strcmp(argv[i + 1], "none"))
+            return 1;
+        if (equals_any(argv[i], separate_arg_options)) {
+            i++;
+            continue;
+        }
+        if (argv[i][0] == '-')
+            continue;
+        const char *ext = strrchr(argv[i], '.');
+        if (!ext || strchr(ext, '/'))
+            continue;
+        static const char *const source_exts[] = {
+            ".c", ".cpp", ".cc", ".cxx", ".c++", ".C", ".m", ".mm", ".s",
+            ".S", ".i", ".ii", NULL
+        };
+        if (equals_any(ext, source_exts))
+            return 1;
+    }
+    return 0;
+}
+
+// The link cache is kept by the ld wrapper. When it is enabled, links of
+// objects and libraries make clang run lld through the ld wrapper
+// instead, with --ld-path. Links that also compile sources aren't, as
+// the temporary objects are named differently every time. Returns the
+// option to add, or NULL.
+static char *ld_wrapper_option(const char *dir, const char *target,
+                               int argc, char **argv) {
+    const char *enable = getenv("LLVM_MINGW_LINK_CACHE");
+    const char *cache_dir = getenv("LLVM_MINGW_OBJCACHE");
+    if (!enable || strcmp(enable, "1") || !cache_dir || !*cache_dir ||
+        !is_link(argc, argv) || has_source_inputs(argc, argv))
+        return NULL;
+    char *ld = concat(dir, target);
+    char *path = concat(ld, "-ld");
+    char *opt = concat("--ld-path=", path);
+    free(path);
+    free(ld);
+    return opt;
+}
+
+static int compile_parallel(int argc, char **argv, const int *inputs,
+                            int nb_inputs, int limit) {
+    const char ***job_argvs = malloc(nb_inputs * sizeof(*job_argvs));
+    for (int job = 0; job < nb_inputs; job++) {
+        const char **job_argv = malloc((argc + 1) * sizeof(*job_argv));
+        int n = 0;
+        for (int i = 0; i < argc; i++) {
+            int skip = 0;
+            for (int j = 0; j < nb_inputs; j++)
+                if (j != job && inputs[j] == i)
+                    skip = 1;
+            if (!skip)
+                job_argv[n++] = argv[i];
+        }
+        job_argv[n] = NULL;
+        job_argvs[job] = job_argv;
+    }
+    int ret = run_parallel(job_argvs, nb_inputs, limit);
+    for (int job = 0; job < nb_inputs; job++)
+        free(job_argvs[job]);
+    free(job_argvs);
+    return ret;
+}
+
+// Time trace and optimization remark collection: With
+// LLVM_MINGW_TIME_TRACE and/or LLVM_MINGW_REMARKS set to a directory,
+// single source compiles are run with -ftime-trace, or with
+// -fsave-optimization-record for the vectorizers and the inliner, and
+// the file that clang writes next to the object file (<object>.json or
+// <object>.opt.yaml) is moved to <dir>/<target>/<source>-<hash>.json or
+// .opt.yaml, for time-trace-report.py and remarks-report.py to aggregate
+// across a whole build.
+
+#define REMARK_PASSES \
+    "-foptimization-record-passes=loop-vectorize|slp-vectorizer|inline"
+
+struct collected_file {
+    const char *dir;
+    const char *ext;
+    const char *flags[3];
+};
+
+// Options that make the driver not produce an object file.
+static const char *const no_object_options[] = {
+    "-E", "-S", "-M", "-MM", "-fsyntax-only", "-###", NULL
+};
+
+// Replace the extension of the last path component, like clang does
+// for naming the trace after the output file.
+static char *replace_extension(const char *path, const char *ext) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char *dot = strrchr(base, '.');
+    size_t len = dot ? (size_t)(dot - path) : strlen(path);
+    char *out = malloc(len + strlen(ext) + 1);
+    memcpy(out, path, len);
+    strcpy(out + len, ext);
+    return out;
+}
+
+// Returns the compiler's exit code, or -1 if this isn't a compile that
+// produces an object file.
+static int run_collecting(const struct collected_file *files, int nb_files,
+                          const char *target, int argc, char **argv,
+                          const char **exec_argv, int nargs) {
+    int compile = 0;
+    const char *input = NULL, *output = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-c")) {
+            compile = 1;
+        } else if (equals_any(argv[i], no_object_options) ||
+                   !strcmp(argv[i], "-")) {
+            return -1;
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            output = argv[++i];
+        } else if (!strncmp(argv[i], "-o", 2) && argv[i][2]) {
+            output = argv[i] + 2;
+        } else if (equals_any(argv[i], separate_arg_options)) {
+            i++;
+        } else if (argv[i][0] != '-') {
+            if (input)
+                return -1;
+            input = argv[i];
+        }
+    }
+    if (!compile || !input || (output && !strcmp(output, "-")))
+        return -1;
+    char *object;
+    if (output) {
+        object = strdup(output);
     } else {
-        target = _T(DEFAULT_TARGET);
+        const char *base = strrchr(input, '/');
+        object = replace_extension(base ? base + 1 : input, ".o");
+    }
+
+    const char **args = malloc((nargs + 3 * nb_files + 1) * sizeof(*args));
+    memcpy(args, exec_argv, nargs * sizeof(*args));
+    int n = nargs;
+    for (int i = 0; i < nb_files; i++)
+        for (int j = 0; j < 3 && files[i].flags[j]; j++)
+            args[n++] = files[i].flags[j];
+    args[n] = NULL;
+    int ret = spawn_clang(args);
+    free(args);
+    if (ret == -1) {
+        perror(exec_argv[0]);
+        ret = 1;
+    }
+
+    // Name the files after the source, and disambiguate sources with the
+    // same name by a hash of the source and object paths.
+    char cwd[4096], hash[65];
+    struct sha256 sha;
+    sha256_init(&sha);
+    if (getcwd(cwd, sizeof(cwd)))
+        sha256_update(&sha, cwd, strlen(cwd) + 1);
+    sha256_update(&sha, input, strlen(input) + 1);
+    sha256_update(&sha, object, strlen(object) + 1);
+    sha256_final(&sha, hash);
+    hash[16] = '\0';
+    const char *base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+
+    for (int i = 0; i < nb_files && ret == 0; i++) {
+        struct stat st;
+        char *file = replace_extension(object, files[i].ext);
+        if (stat(file, &st)) {
+            free(file);
+            continue;
+        }
+        char *target_dir = path_join(files[i].dir, target);
+        mkdir(files[i].dir, 0777);
+        mkdir(target_dir, 0777);
+        char *name = malloc(strlen(base) + strlen(files[i].ext) + 20);
+        sprintf(name, "%s-%s%s", base, hash, files[i].ext);
+        char *dest = path_join(target_dir, name);
+        if (rename(file, dest)) {
+            if (copy_file(file, dest) >= 0)
+                unlink(file);
+            else
+                perror(dest);
+        }
+        free(dest);
+        free(name);
+        free(target_dir);
+        free(file);
+    }
+    free(object);
+    return ret;
+}
+
+// Header maps: For every included header, clang tries the include
+// directories in order, so a header from mingw-w64 (which comes after
+// libc++ and clang's own headers) costs a failed stat or open in each
+// directory before it. "<triple>-clang --build-header-maps", run by
+// build-header-maps.sh at install time, writes a header map (a hash table
+// from include names to paths, which clang maps into memory) for each of
+// the default include directories, for C and for C++. With
+// LLVM_MINGW_HEADER_MAPS=1, compiles of C or C++ sources search the maps
+// first, in the same order as the directories, and then the directories
+// themselves, for anything that the maps don't know about. The maps are
+// ignored if clang, or any of the directories or their subdirectories,
+// has been changed since. Header map lookups ignore case, so includes
+// whose case doesn't match the file are made errors, as they would be
+// without the maps.
+
+#define HMAP_MAGIC 0x686d6170
+#define HMAP_MAX_DIRS 8
+
+struct hmap_header {
+    uint32_t magic;
+    uint16_t version, reserved;
+    uint32_t strings_offset, nb_entries, nb_buckets, max_value_length;
+};
+
+static unsigned hmap_hash(const char *str) {
+    unsigned hash = 0;
+    for (; *str; str++) {
+        unsigned char c = *str;
+        hash += (c >= 'A' && c <= 'Z' ? c + 32 : c) * 13;
+    }
+    return hash;
+}
+
+struct name_list {
+    char **names;
+    int nb, max;
+};
+
+static void add_name(struct name_list *list, char *name) {
+    if (list->nb == list->max) {
+        list->max = list->max * 2 + 64;
+        list->names = realloc(list->names, list->max * sizeof(*list->names));
     }
-    TCHAR *arch = _tcsdup(target);
-    dash = _tcschr(arch, '-');
-    if (dash)
-        *dash = '\0';
+    list->names[list->nb++] = name;
+}
+
+// List all files below root, as paths relative to it, and all
+// directories below it, as full paths.
+static void list_headers(const char *root, const char *rel, int depth,
+                         struct name_list *list, struct name_list *dirs) {
+    char *path = rel ? path_join(root, rel) : strdup(root);
+    DIR *d = opendir(path);
+    free(path);
+    if (!d || depth > 16) {
+        if (d)
+            closedir(d);
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        if (ent->d_name[0] == '.')
+            continue;
+        char *name = rel ? path_join(rel, ent->d_name) : strdup(ent->d_name);
+        char *full = path_join(root, name);
+        struct stat st;
+        int found = !stat(full, &st);
+        if (found && S_ISDIR(st.st_mode)) {
+            list_headers(root, name, depth + 1, list, dirs);
+            free(name);
+            add_name(dirs, full);
+            continue;
+        } else if (found && S_ISREG(st.st_mode)) {
+            add_name(list, name);
+        } else {
+            free(name);
+        }
+        free(full);
+    }
+    closedir(d);
+}
+
+// Write a header map for all files below dir, and return the list of
+// its subdirectories. Fails if two of the files only differ in case, as
+// lookups in header maps are case insensitive.
+static int write_header_map(const char *path, const char *dir,
+                            struct name_list *dirs) {
+    struct name_list list = { 0 };
+    list_headers(dir, NULL, 0, &list, dirs);
+    uint32_t nb_buckets = 8;
+    while (nb_buckets < 2 * (uint32_t) list.nb)
+        nb_buckets *= 2;
+    uint32_t *buckets = calloc(nb_buckets, 3 * sizeof(*buckets));
+    struct buf strings = { 0 };
+    // Offset 0 marks an empty bucket.
+    buf_append(&strings, "", 1);
+    uint32_t prefix = strings.len;
+    buf_append(&strings, dir, strlen(dir));
+    buf_append(&strings, "/", 2);
+    size_t max_value = 0;
+    int ret = 0;
+    for (int i = 0; i < list.nb; i++) {
+        const char *name = list.names[i];
+        uint32_t offset = strings.len;
+        buf_append(&strings, name, strlen(name) + 1);
+        if (strlen(dir) + 1 + strlen(name) > max_value)
+            max_value = strlen(dir) + 1 + strlen(name);
+        for (uint32_t hash = hmap_hash(name);; hash++) {
+            uint32_t *bucket = &buckets[3 * (hash & (nb_buckets - 1))];
+            if (!bucket[0]) {
+                bucket[0] = offset;
+                bucket[1] = prefix;
+                bucket[2] = offset;
+                break;
+            }
+            if (!strcasecmp(strings.data + bucket[0], name)) {
+                fprintf(stderr, "%s: %s and %s differ only in case\n", dir,
+                        strings.data + bucket[0], name);
+                ret = -1;
+                break;
+            }
+        }
+    }
+    struct hmap_header header = {
+        HMAP_MAGIC, 1, 0, sizeof(header) + 12 * nb_buckets, list.nb,
+        nb_buckets, max_value
+    };
+    struct buf out = { 0 };
+    buf_append(&out, (const char *) &header, sizeof(header));
+    buf_append(&out, (const char *) buckets, 12 * nb_buckets);
+    buf_append(&out, strings.data, strings.len);
+    if (!ret && write_file(path, &out)) {
+        perror(path);
+        ret = -1;
+    }
+    for (int i = 0; i < list.nb; i++)
+        free(list.names[i]);
+    free(list.names);
+    free(buckets);
+    free(strings.data);
+    free(out.data);
+    return ret;
+}
+
+static char *header_map_dir(const char *dir, const char *target) {
+    char *share = concat(dir, "../share/llvm-mingw/header-maps/");
+    char *maps = concat(share, target);
+    free(share);
+    return maps;
+}
+
+static void append_stat(struct buf *out, const char *path) {
+    struct buf key = { 0 };
+    append_stat_token(&key, path);
+    buf_append(out, key.data, key.len - 1);
+    free(key.data);
+}
+
+// Write header maps for the directories that clang searches by default,
+// as listed by "clang -v", and <lang>.layout, listing the maps and
+// directories in order with the identity of clang. Each directory is
+// followed by all its subdirectories (with an empty map name), whose
+// identities change when headers are added or removed in them.
+static int build_header_maps(const char *dir, const char *target,
+                             const char **exec_argv, int keep, int nargs) {
+    char *rel_maps = header_map_dir(dir, target);
+    mkdir_p(rel_maps);
+    char *maps = realpath(rel_maps, NULL);
+    free(rel_maps);
+    if (!maps) {
+        perror("header maps");
+        return 1;
+    }
+    static const char *const langs[] = { "c", "c++" };
+    int ret = 0;
+    for (int l = 0; l < 2 && !ret; l++) {
+        const char **args = malloc((nargs + 7) * sizeof(*args));
+        int n = 0;
+        for (int i = keep - 1; i < nargs; i++)
+            args[n++] = exec_argv[i];
+        args[n++] = "-x";
+        args[n++] = langs[l];
+        args[n++] = "-E";
+        args[n++] = "-v";
+        args[n++] = "/dev/null";
+        args[n] = NULL;
+        struct buf err = { 0 };
+        if (capture_stderr(args, 1, &err)) {
+            fwrite(err.data, 1, err.len, stderr);
+            ret = 1;
+        }
+        buf_append(&err, "", 1);
+        free(args);
+
+        struct buf layout = { 0 };
+        append_stat(&layout, exec_argv[keep - 1]);
+        buf_append(&layout, "\n", 1);
+        char *line = strstr(err.data, "#include <...> search starts here:");
+        line = line ? strchr(line, '\n') : NULL;
+        int nb_dirs = 0;
+        while (!ret && line && line[1] == ' ') {
+            char *start = line + 2, *end = strchr(start, '\n');
+            if (!end)
+                break;
+            *end = '\0';
+            line = end;
+            char *include = realpath(start, NULL);
+            if (!include)
+                continue;
+            if (++nb_dirs > HMAP_MAX_DIRS) {
+                fprintf(stderr, "Too many include directories\n");
+                ret = 1;
+            }
+            char name[40];
+            snprintf(name, sizeof(name), "%s-%d.hmap", langs[l], nb_dirs);
+            char *map = path_join(maps, name);
+            struct name_list subdirs = { 0 };
+            if (!ret && write_header_map(map, include, &subdirs))
+                ret = 1;
+            buf_append(&layout, map, strlen(map));
+            for (int i = -1; i < subdirs.nb; i++) {
+                const char *path = i < 0 ? include : subdirs.names[i];
+                buf_append(&layout, "\t", 1);
+                buf_append(&layout, path, strlen(path));
+                buf_append(&layout, "\t", 1);
+                append_stat(&layout, path);
+                buf_append(&layout, "\n", 1);
+            }
+            for (int i = 0; i < subdirs.nb; i++)
+                free(subdirs.names[i]);
+            free(subdirs.names);
+            free(map);
+            free(include);
+        }
+        free(err.data);
+        char name[40];
+        snprintf(name, sizeof(name), "%s.layout", langs[l]);
+        char *path = path_join(maps, name);
+        if (!nb_dirs) {
+            fprintf(stderr, "No include directories found for %s\n",
+                    langs[l]);
+            ret = 1;
+        }
+        if (ret) {
+            unlink(path);
+        } else if (write_file(path, &layout)) {
+            perror(path);
+            ret = 1;
+        }
+        free(path);
+        free(layout.data);
+    }
+    free(maps);
+    return ret;
+}
+
+// Options that change which directories clang searches by default.
+static const char *const header_map_options[] = {
+    "-nostdinc", "-nostdlibinc", "-nobuiltininc", "--sysroot", "-isysroot",
+    "-resource-dir", "-stdlib=", "-target", "--target=", "--gcc-toolchain",
+    "-x", NULL
+};
+
+// Add the options for searching the default include directories through
+// header maps, if all sources are of the same language and there are
+// valid maps for it. Returns the new number of arguments.
+static int add_header_maps(const char *dir, const char *target, int argc,
+                           char **argv, const char **exec_argv, int keep,
+                           int arg) {
+    const char *env = getenv("LLVM_MINGW_HEADER_MAPS");
+    if (!env || !*env || !strcmp(env, "0"))
+        return arg;
+    int cxx_driver = 0;
+    for (int i = keep; i < arg; i++)
+        if (!strcmp(exec_argv[i], "--driver-mode=g++"))
+            cxx_driver = 1;
+    const char *lang = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (starts_with_any(argv[i], header_map_options) ||
+            !strcmp(argv[i], "-"))
+            return arg;
+        if (equals_any(argv[i], separate_arg_options)) {
+            i++;
+            continue;
+        }
+        if (argv[i][0] == '-')
+            continue;
+        const char *ext = strrchr(argv[i], '.'), *cur;
+        if (!ext || strchr(ext, '/'))
+            continue;
+        if (!strcmp(ext, ".c"))
+            cur = cxx_driver ? "c++" : "c";
+        else if (!strcmp(ext, ".cpp") || !strcmp(ext, ".cc") ||
+                 !strcmp(ext, ".cxx") || !strcmp(ext, ".c++") ||
+                 !strcmp(ext, ".C"))
+            cur = "c++";
+        else if (!strcmp(ext, ".S") || !strcmp(ext, ".h") ||
+                 !strcmp(ext, ".hpp") || !strcmp(ext, ".m") ||
+                 !strcmp(ext, ".mm") || !strcmp(ext, ".i") ||
+                 !strcmp(ext, ".ii"))
+            return arg;
+        else
+            continue;
+        if (lang && strcmp(lang, cur))
+            return arg;
+        lang = cur;
+    }
+    if (!lang)
+        return arg;
+
+    char *maps = header_map_dir(dir, target);
+    char *name = concat(lang, ".layout");
+    char *path = path_join(maps, name);
+    free(name);
+    free(maps);
+    struct buf layout = { 0 };
+    int ok = !read_file(path, &layout) && layout.len;
+    free(path);
+    buf_append(&layout, "", 1);
+
+    // The first line identifies clang, and the following ones each hold a
+    // header map, the directory it maps and the identity of that, or
+    // (without a map) one of the subdirectories and its identity.
+    const char *hmaps[HMAP_MAX_DIRS], *dirs[HMAP_MAX_DIRS];
+    int nb_maps = 0;
+    struct buf cur = { 0 };
+    char *line = layout.data;
+    char *next = strchr(line, '\n');
+    if (ok && next) {
+        *next++ = '\0';
+        append_stat(&cur, exec_argv[keep - 1]);
+        buf_append(&cur, "", 1);
+        ok = !strcmp(line, cur.data);
+        line = next;
+    }
+    while (ok && *line) {
+        next = strchr(line, '\n');
+        char *tab1 = strchr(line, '\t');
+        char *tab2 = tab1 ? strchr(tab1 + 1, '\t') : NULL;
+        if (!next || !tab2) {
+            ok = 0;
+            break;
+        }
+        *next++ = *tab1 = *tab2 = '\0';
+        cur.len = 0;
+        append_stat(&cur, tab1 + 1);
+        buf_append(&cur, "", 1);
+        ok = !strcmp(tab2 + 1, cur.data);
+        if (*line && nb_maps < HMAP_MAX_DIRS) {
+            hmaps[nb_maps] = line;
+            dirs[nb_maps++] = tab1 + 1;
+        } else if (*line) {
+            ok = 0;
+        }
+        line = next;
+    }
+    free(cur.data);
+    if (!ok || !nb_maps) {
+        free(layout.data);
+        return arg;
+    }
+    // The driver would add the directories before our maps, so they are
+    // left out with -nostdinc, and added back after the maps.
+    exec_argv[arg++] = "-nostdinc";
+    for (int i = 0; i < 2 * nb_maps; i++) {
+        exec_argv[arg++] = "-Xclang";
+        exec_argv[arg++] = "-internal-isystem";
+        exec_argv[arg++] = "-Xclang";
+        exec_argv[arg++] = i < nb_maps ? hmaps[i] : dirs[i - nb_maps];
+    }
+    exec_argv[arg++] = "-Werror=nonportable-system-include-path";
+    return arg;
+}
+
+// Precompiled headers: With LLVM_MINGW_PCH=1 (or LLVM_MINGW_PCH_CACHE)
+// set, for single source compiles whose first include, preceded by
+// nothing but #define lines and comments, is <windows.h> or one of the
+// common libc++ headers, a precompiled header of that prefix is used if
+// there is one. They are looked for in
+// <prefix>/share/llvm-mingw/pch/<target>, where build-pch.sh installs
+// the common variants, and in LLVM_MINGW_PCH_CACHE/<target>, where
+// missing ones are built on first use. A PCH is named after a hash of
+// the compiler identity, the language, the #define lines and all options
+// that can affect how the header is parsed; any option that we don't
+// know to be harmless disables the PCH. The headers that went into a PCH
+// are listed in a .deps file next to it, and a PCH is only used if none
+// of them has changed, and if none of them is shadowed by a header in the
+// user's include directories. If clang rejects a PCH anyway, the compile
+// is rerun without it, and the PCH is marked as failed so that it isn't
+// tried again.
+
+static const char *const pch_cxx_headers[] = {
+    "<algorithm>", "<array>", "<atomic>", "<chrono>", "<functional>",
+    "<iostream>", "<map>", "<memory>", "<mutex>", "<set>", "<sstream>",
+    "<string>", "<thread>", "<unordered_map>", "<utility>", "<vector>",
+    NULL
+};
+
+// Options (matched as prefixes) that are part of the PCH key, and that
+// are passed on when building the PCH.
+static const char *const pch_key_options[] = {
+    "-D", "-U", "-O", "-f", "-m", "-std=", "-ansi", NULL
+};
+
+// Options (matched as prefixes) that don't change how a header is parsed.
+static const char *const pch_ignored_options[] = {
+    "-W", "-g", "-pedantic", "-pipe", "-MD", "-MMD", "-MP",
+    "-Qunused-arguments", NULL
+};
+
+struct pch_args {
+    const char *input;
+    const char *lang;
+    const char **key;
+    const char **dirs;
+    int nb_key, nb_dirs;
+};
+
+// Check whether the user's arguments are a single source compile that a
+// PCH can be used for, and collect the options that go into the key.
+static int parse_pch_args(int argc, char **argv, int cxx_driver,
+                          struct pch_args *args) {
+    int compile = 0;
+    const char *lang = NULL;
+    args->input = NULL;
+    args->key = malloc(argc * sizeof(*args->key));
+    args->dirs = malloc((argc + 1) * sizeof(*args->dirs));
+    args->nb_key = args->nb_dirs = 0;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "-c")) {
+            compile = 1;
+        } else if (!strcmp(arg, "-o") || !strcmp(arg, "-MF") ||
+                   !strcmp(arg, "-MT") || !strcmp(arg, "-MQ")) {
+            if (++i >= argc)
+                return 0;
+        } else if (!strncmp(arg, "-o", 2)) {
+        } else if (!strcmp(arg, "-I") || !strcmp(arg, "-iquote") ||
+                   !strcmp(arg, "-isystem") || !strcmp(arg, "-idirafter")) {
+            if (++i >= argc)
+                return 0;
+            args->dirs[args->nb_dirs++] = argv[i];
+        } else if (!strncmp(arg, "-I", 2)) {
+            args->dirs[args->nb_dirs++] = arg + 2;
+        } else if (!strcmp(arg, "-D") || !strcmp(arg, "-U")) {
+            if (++i >= argc)
+                return 0;
+            args->key[args->nb_key++] = concat(arg, argv[i]);
+        } else if (!strcmp(arg, "-x")) {
+            if (++i >= argc || args->input)
+                return 0;
+            if (strcmp(argv[i], "c") && strcmp(argv[i], "c++"))
+                return 0;
+            lang = argv[i];
+        } else if (starts_with_any(arg, color_options)) {
+        } else if (!strncmp(arg, "-Wp,", 4) || !strcmp(arg, "-mllvm")) {
+            return 0;
+        } else if (!strcmp(arg, "-w")) {
+        } else if (starts_with_any(arg, pch_key_options)) {
+            args->key[args->nb_key++] = arg;
+        } else if (starts_with_any(arg, pch_ignored_options)) {
+        } else if (arg[0] != '-' && !args->input) {
+            args->input = arg;
+        } else {
+            return 0;
+        }
+    }
+    if (!compile || !args->input)
+        return 0;
+    if (!lang) {
+        const char *ext = strrchr(args->input, '.');
+        if (!ext || strchr(ext, '/'))
+            return 0;
+        if (!strcmp(ext, ".c"))
+            lang = cxx_driver ? "c++" : "c";
+        else if (!strcmp(ext, ".cpp") || !strcmp(ext, ".cc") ||
+                 !strcmp(ext, ".cxx") || !strcmp(ext, ".c++") ||
+                 !strcmp(ext, ".C"))
+            lang = "c++";
+        else
+            return 0;
+    }
+    args->lang = lang;
+    return 1;
+}
+
+// Append a #define line in a normalized form, without comments and with
+// single spaces, unless it contains literals.
+static void append_define(struct buf *defines, const char *rest) {
+    buf_append(defines, "#define", 7);
+    if (strchr(rest, '"') || strchr(rest, '\'')) {
+        buf_append(defines, rest, strlen(rest));
+        buf_append(defines, "\n", 1);
+        return;
+    }
+    int space = 0;
+    while (*rest && strncmp(rest, "//", 2)) {
+        if (!strncmp(rest, "/*", 2)) {
+            rest = strstr(rest, "*/") + 2;
+            space = 1;
+        } else if (*rest == ' ' || *rest == '\t') {
+            rest++;
+            space = 1;
+        } else {
+            if (space)
+                buf_append(defines, " ", 1);
+            buf_append(defines, rest++, 1);
+            space = 0;
+        }
+    }
+    buf_append(defines, "\n", 1);
+}
+
+// Scan the start of a source file for an include that a PCH can stand
+// in for. Returns the header as written, e.g. "<windows.h>", with the
+// #define lines before it appended to defines, or NULL.
+static char *scan_pch_prefix(const char *path, const char *lang,
+                             struct buf *defines) {
+    char data[16384];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    ssize_t len = read(fd, data, sizeof(data) - 1);
+    close(fd);
+    if (len <= 0)
+        return NULL;
+    data[len] = '\0';
+    char *ptr = data;
+    if (!strncmp(ptr, "\xef\xbb\xbf", 3))
+        ptr += 3;
+    while (*ptr) {
+        if (*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == '\n') {
+            ptr++;
+            continue;
+        }
+        if (!strncmp(ptr, "//", 2)) {
+            ptr = strchr(ptr, '\n');
+            if (!ptr)
+                return NULL;
+            continue;
+        }
+        if (!strncmp(ptr, "/*", 2)) {
+            ptr = strstr(ptr + 2, "*/");
+            if (!ptr)
+                return NULL;
+            ptr += 2;
+            continue;
+        }
+        char *end = strchr(ptr, '\n');
+        if (*ptr != '#' || !end)
+            return NULL;
+        *end = '\0';
+        if (end > ptr && end[-1] == '\r')
+            end[-1] = '\0';
+        char *line = ptr;
+        ptr = end + 1;
+        // Line continuations, and block comments that go on past the end
+        // of the line, are left for the compiler to deal with.
+        size_t n = strlen(line);
+        char *comment = strstr(line, "/*");
+        if (line[n - 1] == '\\' || (comment && !strstr(comment, "*/")))
+            return NULL;
+        char *directive = line + 1;
+        while (*directive == ' ' || *directive == '\t')
+            directive++;
+        if (!strncmp(directive, "define", 6) &&
+            (directive[6] == ' ' || directive[6] == '\t')) {
+            append_define(defines, directive + 6);
+            continue;
+        }
+        if (strncmp(directive, "include", 7))
+            return NULL;
+        char *name = directive + 7;
+        while (*name == ' ' || *name == '\t')
+            name++;
+        char *close = NULL;
+        if (*name == '<')
+            close = strchr(name + 1, '>');
+        else if (*name == '"')
+            close = strchr(name + 1, '"');
+        if (!close)
+            return NULL;
+        for (char *rest = close + 1; *rest && strncmp(rest, "//", 2); rest++)
+            if (*rest != ' ' && *rest != '\t')
+                return NULL;
+        close[1] = '\0';
+        if (!strcmp(name, "<windows.h>") || !strcmp(name, "\"windows.h\"") ||
+            (!strcmp(lang, "c++") && equals_any(name, pch_cxx_headers)))
+            return strdup(name);
+        return NULL;
+    }
+    return NULL;
+}
+
+// The name a dependency is included by, relative to the include
+// directory it was found in.
+static const char *pch_include_name(const char *path) {
+    const char *libcxx = NULL, *include = NULL;
+    for (const char *ptr = strstr(path, "/include/"); ptr;
+         ptr = strstr(ptr + 1, "/include/")) {
+        include = ptr + 9;
+        if (!strncmp(include, "c++/v1/", 7))
+            libcxx = include + 7;
+    }
+    if (libcxx)
+        return libcxx;
+    if (include)
+        return include;
+    const char *base = strrchr(path, '/');
+    return base ? base + 1 : path;
+}
+
+// Check that none of the headers a PCH was built from has changed, and
+// that none of them would be found in the user's include directories
+// instead.
+static int pch_usable(const char *base, const struct pch_args *args) {
+    char *pch = concat(base, ".pch");
+    char *deps_path = concat(base, ".deps");
+    char *failed = concat(base, ".failed");
+    struct buf deps = { 0 };
+    int ok = !access(pch, R_OK) && access(failed, F_OK) &&
+             !read_file(deps_path, &deps) && deps.len;
+    free(pch);
+    free(deps_path);
+    free(failed);
+    buf_append(&deps, "", 1);
+    char *line = deps.data;
+    while (ok && line && *line) {
+        char *next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        long long size, mtime;
+        int pos = 0;
+        struct stat st;
+        if (sscanf(line, "%lld %lld %n", &size, &mtime, &pos) != 2 || !pos ||
+            stat(line + pos, &st) || st.st_size != size ||
+            st.st_mtime != mtime) {
+            ok = 0;
+            break;
+        }
+        const char *name = pch_include_name(line + pos);
+        for (int i = 0; i < args->nb_dirs && ok; i++) {
+            char *shadow = path_join(args->dirs[i], name);
+            if (!access(shadow, F_OK))
+                ok = 0;
+            free(shadow);
+        }
+        line = next;
+    }
+    free(deps.data);
+    return ok;
+}
+
+// Write the list of headers from a depfile written by clang, with their
+// sizes and modification times, to <base>.deps.
+static int write_pch_deps(const char *base, const char *depfile,
+                          const char *header) {
+    struct buf in = { 0 }, out = { 0 };
+    if (read_file(depfile, &in))
+        return -1;
+    buf_append(&in, "", 1);
+    char *ptr = strstr(in.data, ": ");
+    char *path = malloc(in.len);
+    while (ptr && *ptr) {
+        // Read one path, with spaces escaped by backslashes.
+        while (*ptr == ' ' || *ptr == '\n' || *ptr == '\r' || *ptr == ':' ||
+               (*ptr == '\\' && (ptr[1] == '\n' || ptr[1] == '\r')))
+            ptr++;
+        size_t n = 0;
+        while (*ptr && *ptr != ' ' && *ptr != '\n' && *ptr != '\r') {
+            if (*ptr == '\\' && ptr[1] == ' ')
+                ptr++;
+            path[n++] = *ptr++;
+        }
+        path[n] = '\0';
+        struct stat st;
+        if (!n || !strcmp(path, header))
+            continue;
+        if (stat(path, &st)) {
+            free(path);
+            free(in.data);
+            free(out.data);
+            return -1;
+        }
+        char str[100];
+        snprintf(str, sizeof(str), "%lld %lld ", (long long) st.st_size,
+                 (long long) st.st_mtime);
+        buf_append(&out, str, strlen(str));
+        buf_append(&out, path, n);
+        buf_append(&out, "\n", 1);
+    }
+    free(path);
+    char *deps = concat(base, ".deps");
+    int ret = write_file(deps, &out);
+    free(deps);
+    free(in.data);
+    free(out.data);
+    return ret;
+}
+
+// Build the PCH <base>.pch from a header with the #define lines and the
+// include. Returns 0 on success.
+static int build_pch(const char *base, const char **exec_argv, int keep,
+                     int user_args, const struct pch_args *args,
+                     const struct buf *defines, const char *include) {
+    char *header = concat(base, ".h");
+    char *pch = concat(base, ".pch");
+    char *tmp = malloc(strlen(base) + 30);
+    sprintf(tmp, "%s.%d.tmp", base, (int) getpid());
+    char *depfile = concat(tmp, ".d");
+
+    struct buf text = { 0 };
+    buf_append(&text, defines->data, defines->len);
+    buf_append(&text, "#include ", 9);
+    buf_append(&text, include, strlen(include));
+    buf_append(&text, "\n", 1);
+    int ret = write_file(header, &text);
+    free(text.data);
+
+    int nargs = user_args - keep + 1 + args->nb_key + 10;
+    const char **pch_argv = malloc(nargs * sizeof(*pch_argv));
+    int n = 0;
+    for (int i = keep - 1; i < user_args; i++)
+        pch_argv[n++] = exec_argv[i];
+    for (int i = 0; i < args->nb_key; i++)
+        pch_argv[n++] = args->key[i];
+    pch_argv[n++] = "-x";
+    pch_argv[n++] = !strcmp(args->lang, "c") ? "c-header" : "c++-header";
+    pch_argv[n++] = header;
+    pch_argv[n++] = "-o";
+    pch_argv[n++] = tmp;
+    pch_argv[n++] = "-MD";
+    pch_argv[n++] = "-MF";
+    pch_argv[n++] = depfile;
+    pch_argv[n] = NULL;
+
+    struct buf err = { 0 };
+    if (!ret && (capture_stderr(pch_argv, 1, &err) ||
+                 write_pch_deps(base, depfile, header) ||
+                 rename(tmp, pch)))
+        ret = -1;
+    if (ret) {
+        // Don't try again for every compile.
+        char *failed = concat(base, ".failed");
+        write_file(failed, &err);
+        free(failed);
+        unlink(tmp);
+    }
+    unlink(depfile);
+    free(err.data);
+    free(pch_argv);
+    free(depfile);
+    free(tmp);
+    free(pch);
+    free(header);
+    return ret;
+}
+
+// Returns the path of a PCH to use for this compile, or NULL.
+static char *find_pch(const char *dir, const char *target, int argc,
+                      char **argv, const char **exec_argv, int keep,
+                      int user_args) {
+    const char *env = getenv("LLVM_MINGW_PCH");
+    const char *cache = getenv("LLVM_MINGW_PCH_CACHE");
+    if (env && *env ? !strcmp(env, "0") : !(cache && *cache))
+        return NULL;
+    if (getenv("CCACHE"))
+        return NULL;
+    char *installed = concat(dir, "../share/llvm-mingw/pch/");
+    char *dirs[2] = { concat(installed, target), NULL };
+    free(installed);
+    if (cache && *cache)
+        dirs[1] = path_join(cache, target);
+    char *pch = NULL, *include = NULL;
+    struct buf defines = { 0 };
+    struct pch_args args;
+    int cxx_driver = 0;
+    for (int i = keep; i < user_args; i++)
+        if (!strcmp(exec_argv[i], "--driver-mode=g++"))
+            cxx_driver = 1;
+
+    struct stat st;
+    if ((stat(dirs[0], &st) && !dirs[1]) ||
+        !parse_pch_args(argc, argv, cxx_driver, &args))
+        goto out;
+    for (int i = 0; cache_env_vars[i]; i++)
+        if (getenv(cache_env_vars[i]))
+            goto out;
+    include = scan_pch_prefix(args.input, args.lang, &defines);
+    if (!include)
+        goto out;
+    // A header in quotes would be found next to the source first.
+    if (include[0] == '"') {
+        char *src_dir = strdup(args.input);
+        char *sep = strrchr(src_dir, '/');
+        if (sep)
+            *sep = '\0';
+        args.dirs[args.nb_dirs++] = sep ? src_dir : ".";
+    }
+
+    char *clang = find_in_path(exec_argv[keep - 1]);
+    char *real = clang ? realpath(clang, NULL) : NULL;
+    free(clang);
+    if (!real)
+        goto out;
+    struct buf key = { 0 };
+    buf_append_token(&key, "llvm-mingw-pch-1");
+    buf_append_token(&key, real);
+    append_stat_token(&key, real);
+    free(real);
+    buf_append_token(&key, args.lang);
+    buf_append_token(&key, include);
+    buf_append(&key, defines.data, defines.len);
+    buf_append(&key, "", 1);
+    for (int i = keep; i < user_args; i++)
+        buf_append_token(&key, exec_argv[i]);
+    for (int i = 0; i < args.nb_key; i++)
+        buf_append_token(&key, args.key[i]);
+    struct sha256 sha;
+    char hash[65];
+    sha256_init(&sha);
+    sha256_update(&sha, key.data, key.len);
+    sha256_final(&sha, hash);
+    free(key.data);
+    hash[32] = '\0';
+
+    for (int i = 0; i < 2 && !pch; i++) {
+        if (!dirs[i])
+            continue;
+        char *base = path_join(dirs[i], hash);
+        if (pch_usable(base, &args)) {
+            pch = concat(base, ".pch");
+        } else if (i == 1) {
+            char *failed = concat(base, ".failed");
+            if (access(failed, F_OK) && !mkdir_p(dirs[i]) &&
+                !build_pch(base, exec_argv, keep, user_args, &args, &defines,
+                           include) &&
+                pch_usable(base, &args))
+                pch = concat(base, ".pch");
+            free(failed);
+        }
+        free(base);
+    }
+out:
+    free(include);
+    free(defines.data);
+    free(dirs[0]);
+    free(dirs[1]);
+    return pch;
+}
+
+// Run the compile with a PCH, and if clang rejects the PCH after all,
+// mark it as failed and run the compile again without it (the last two
+// arguments).
+static int run_with_pch(const char **exec_argv, int keep, int nargs) {
+    const char **args = malloc((nargs + 2) * sizeof(*args));
+    memcpy(args, exec_argv, (nargs + 1) * sizeof(*args));
+    int color = 0;
+    for (int i = keep; i < nargs; i++)
+        if (starts_with_any(args[i], color_options))
+            color = 1;
+    const char *term = getenv("TERM");
+    if (!color && isatty(2) && term && strcmp(term, "dumb")) {
+        args[nargs] = "-fcolor-diagnostics";
+        args[nargs + 1] = NULL;
+    }
+
+    char *rsp_path;
+    const char **rsp_argv = write_response_file(args, keep, &rsp_path);
+    struct buf err = { 0 };
+    int ret = capture_stderr(rsp_argv ? rsp_argv : args, 0, &err);
+    if (rsp_argv)
+        unlink(rsp_path);
+    buf_append(&err, "", 1);
+    if (ret != 0 && (strstr(err.data, "precompiled header") ||
+                     strstr(err.data, "PCH file"))) {
+        const char *pch = exec_argv[nargs - 1];
+        char *failed = malloc(strlen(pch) + 10);
+        strcpy(failed, pch);
+        strcpy(failed + strlen(failed) - 4, ".failed");
+        err.len--;
+        if (!write_file(failed, &err))
+            fprintf(stderr, "warning: %s was rejected by clang, and won't "
+                    "be used again\n", pch);
+        free(failed);
+        free(err.data);
+        free(args);
+        exec_argv[nargs - 2] = NULL;
+        return run_final_clang(exec_argv, keep);
+    }
+    fwrite(err.data, 1, err.len - 1, stderr);
+    free(err.data);
+    if (ret < 0) {
+        perror(args[0]);
+        ret = 1;
+    }
+    free(args);
+    return ret;
+}
+#endif
+
+// Check if a link writes a PDB, e.g. with -Wl,-pdb,<file> or
+// -Xlinker --pdb=<file>.
+static int links_pdb(int argc, TCHAR **argv, const struct profile *profile) {
+    for (int i = 0; i < profile->nb_ldflags; i++)
+        if (is_pdb_option(profile->ldflags[i]))
+            return 1;
+    for (int i = 1; i < argc; i++) {
+        if (!_tcscmp(argv[i], _T("-Xlinker")) && i + 1 < argc) {
+            if (is_pdb_option(argv[++i]))
+                return 1;
+        } else if (!_tcsncmp(argv[i], _T("-Wl,"), 4)) {
+            TCHAR *opts = _tcsdup(argv[i] + 4);
+            int found = 0;
+            for (TCHAR *opt = opts; opt && !found; ) {
+                TCHAR *comma = _tcschr(opt, ',');
+                if (comma)
+                    *comma++ = '\0';
+                found = is_pdb_option(opt);
+                opt = comma;
+            }
+            free(opts);
+            if (found)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+int _tmain(int argc, TCHAR* argv[]) {
+    const TCHAR *dir;
+    const TCHAR *basename;
+    const TCHAR *target;
+    const TCHAR *exe;
+    split_argv(argv[0], &dir, &basename, &target, &exe);
+    TCHAR *arch = get_arch(target);
+    expand_response_files(&argc, &argv);
 
     // Check if trying to compile Ada; if we try to do this, invoking clang
     // would end up invoking <triplet>-gcc with the same arguments, which ends
@@ -268,14 +1977,18 @@ int _tmain(int argc, TCHAR* argv[]) {
         }
     }
 
-    int max_arg = argc + 20;
+    const struct profile *profile = get_profile(dir, target);
+    if (!profile)
+        return 1;
+
+    int max_arg = argc + 100 + profile->nb_cflags + 2 * profile->nb_ldflags;
     const TCHAR **exec_argv = malloc(max_arg * sizeof(*exec_argv));
     int arg = 0;
     if (getenv("CCACHE"))
         exec_argv[arg++] = _T("ccache");
     exec_argv[arg++] = concat(dir, _T(CLANG));
+    int keep = arg;
 
-    // If changing this wrapper, change clang-target-wrapper.sh accordingly.
     if (!_tcscmp(exe, _T("clang++")) || !_tcscmp(exe, _T("g++")) || !_tcscmp(exe, _T("c++")))
         exec_argv[arg++] = _T("--driver-mode=g++");
 
@@ -301,8 +2014,93 @@ int _tmain(int argc, TCHAR* argv[]) {
     exec_argv[arg++] = _T("-fuse-cxa-atexit");
     exec_argv[arg++] = _T("-Qunused-arguments");
 
-    for (int i = 1; i < argc; i++)
+    TCHAR *ld_option = NULL;
+    int linking = 1;
+#ifndef _WIN32
+    ld_option = ld_wrapper_option(dir, target, argc, argv);
+    linking = is_link(argc, argv);
+#endif
+
+    // Options from LLVM_MINGW_PROFILE, before the user's own ones so that
+    // those take precedence. The ld wrapper adds the linker options
+    // itself. The linker options are left out of compiles, where they
+    // would only change the cache keys.
+    for (int i = 0; i < profile->nb_cflags; i++)
+        exec_argv[arg++] = escape(profile->cflags[i]);
+    for (int i = 0; i < profile->nb_ldflags && linking && !ld_option; i++) {
+        exec_argv[arg++] = _T("-Xlinker");
+        exec_argv[arg++] = escape(profile->ldflags[i]);
+    }
+
+    // With LLVM_MINGW_ORDER_INSTRUMENT set, instrument all functions, and
+    // link in a runtime (liborderfile-rt.a, from build-orderfile-rt.sh)
+    // that records the order in which they first are called, for
+    // make-order-file.py to produce a link order file from.
+    const char *order_instrument = getenv("LLVM_MINGW_ORDER_INSTRUMENT");
+    int order_link = 0;
+    if (order_instrument && *order_instrument &&
+        strcmp(order_instrument, "0")) {
+        exec_argv[arg++] = _T("-finstrument-functions-after-inlining");
+        for (int i = 1; i < argc; i++)
+            if (argv[i][0] != '-')
+                order_link = 1;
+        for (int i = 1; i < argc; i++)
+            if (!_tcscmp(argv[i], _T("-c")) || !_tcscmp(argv[i], _T("-S")) ||
+                !_tcscmp(argv[i], _T("-E")) || !_tcscmp(argv[i], _T("-M")) ||
+                !_tcscmp(argv[i], _T("-MM")) ||
+                !_tcscmp(argv[i], _T("-fsyntax-only")))
+                order_link = 0;
+    }
+
+    // With LLVM_MINGW_GHASH set, before the user's options, so that
+    // -gno-codeview-ghash can turn it off again.
+    int ghash = use_ghash();
+    if (ghash)
+        exec_argv[arg++] = _T("-gcodeview-ghash");
+
+#ifndef _WIN32
+    // Before the user's options, as part of the PCH key.
+    arg = add_header_maps(dir, target, argc, argv, exec_argv, keep, arg);
+#endif
+
+    int user_args = arg;
+    int delayimp = 0;
+    for (int i = 1; i < argc; i++) {
+        // -Wl,--order-profile=<file> is handled by the ld wrapper, but
+        // clang calls lld directly.
+        if (!_tcsncmp(argv[i], _T("-Wl,--order-profile="), 20)) {
+            TCHAR *order = concat(_T("-Wl,-Xlink=-order:@"), argv[i] + 20);
+            exec_argv[arg++] = escape(order);
+            free(order);
+            continue;
+        }
+        // Likewise for -Wl,--delayload=<dll>, which also needs the helper
+        // from libdelayimp.a.
+        if (!_tcsncmp(argv[i], _T("-Wl,--delayload="), 16)) {
+            TCHAR *delayload = concat(_T("-Wl,-Xlink=-delayload:"),
+                                      argv[i] + 16);
+            exec_argv[arg++] = escape(delayload);
+            free(delayload);
+            delayimp = 1;
+            continue;
+        }
         exec_argv[arg++] = escape(argv[i]);
+    }
+    if (delayimp)
+        exec_argv[arg++] = _T("-ldelayimp");
+
+    // Merge the types of PDB links by the hashes from -gcodeview-ghash.
+    // The mingw lld frontend passes -debug for the PDB first, and this
+    // one takes precedence.
+    if (ghash && !ld_option && links_pdb(argc, argv, profile) &&
+        use_ghash_link(dir))
+        exec_argv[arg++] = _T("-Wl,-Xlink=-debug:ghash");
+
+    if (ld_option)
+        exec_argv[arg++] = ld_option;
+
+    if (order_link)
+        exec_argv[arg++] = _T("-lorderfile-rt");
 
     exec_argv[arg] = NULL;
     if (arg > max_arg) {
@@ -316,26 +2114,90 @@ int _tmain(int argc, TCHAR* argv[]) {
     // libtool parses the output of "-v" and can't handle the backslash
     // form of paths. A proper upstream solution has been discussed at
     // https://reviews.llvm.org/D53066 but hasn't been finished yet.
-    for (int i = 1; i < argc; i++)
-        if (!_tcscmp(argv[i], _T("-v")))
-            return exec_filtered(exec_argv);
-
-    int ret = _tspawnvp(_P_WAIT, exec_argv[0], exec_argv);
-    if (ret == -1) {
-        _tperror(exec_argv[0]);
-        return 1;
+    for (int i = 1; i < argc; i++) {
+        if (!_tcscmp(argv[i], _T("-v"))) {
+            TCHAR *rsp_path;
+            const TCHAR **rsp_argv = write_response_file(exec_argv, keep,
+                                                         &rsp_path);
+            if (!rsp_argv)
+                return exec_filtered(exec_argv);
+            int ret = exec_filtered(rsp_argv);
+            _tunlink(rsp_path);
+            return ret;
+        }
     }
-    return ret;
 #else
-    // On unix, exec() runs the target executable within this same process,
-    // making the return code propagate implicitly.
-    // Windows doesn't have such mechanisms, and the exec() family of functions
-    // makes the calling process exit immediately and always returning
-    // a zero return. This doesn't work for our case where we need the
-    // return code propagated.
-    _texecvp(exec_argv[0], EXECVP_CAST exec_argv);
-
-    _tperror(exec_argv[0]);
-    return 1;
+    if (argc == 2 && !strcmp(argv[1], "--build-header-maps"))
+        return build_header_maps(dir, target, exec_argv, keep, user_args);
+
+    int *inputs = malloc(argc * sizeof(*inputs));
+    int nb_inputs = find_parallel_inputs(argc, argv, inputs);
+    if (nb_inputs > 1) {
+        int limit = get_job_limit();
+        if (limit > 1)
+            return compile_parallel(argc, argv, inputs, nb_inputs, limit);
+    }
+    free(inputs);
+
+    if (linking) {
+        int threads = jobserver_link_threads();
+        char *lto_cache = NULL;
+        if (uses_thinlto(argc, argv))
+            lto_cache = thinlto_cache_dir(target);
+        if (threads > 0 || lto_cache)
+            return run_link(argc, argv, exec_argv, arg, threads, lto_cache);
+    }
+
+    char *pch = find_pch(dir, target, argc, argv, exec_argv, keep, user_args);
+    if (pch) {
+        exec_argv[arg++] = "-include-pch";
+        exec_argv[arg++] = pch;
+        exec_argv[arg] = NULL;
+    }
+
+    struct collected_file collect[2];
+    int nb_collect = 0;
+    const char *time_trace = getenv("LLVM_MINGW_TIME_TRACE");
+    if (time_trace && *time_trace)
+        collect[nb_collect++] = (struct collected_file) {
+            time_trace, ".json", { "-ftime-trace" }
+        };
+    const char *remarks = getenv("LLVM_MINGW_REMARKS");
+    if (remarks && *remarks) {
+        // With profile data, the remarks also include the hotness.
+        const char *hotness = NULL;
+        for (int i = 1; i < argc; i++)
+            if (!strncmp(argv[i], "-fprofile-instr-use", 19) ||
+                !strncmp(argv[i], "-fprofile-use", 13))
+                hotness = "-fdiagnostics-show-hotness";
+        collect[nb_collect++] = (struct collected_file) {
+            remarks, ".opt.yaml",
+            { "-fsave-optimization-record", REMARK_PASSES, hotness }
+        };
+    }
+    if (nb_collect) {
+        int ret = run_collecting(collect, nb_collect, target, argc, argv,
+                                 exec_argv, arg);
+        if (ret >= 0)
+            return ret;
+    }
+
+    const char *objcache = getenv("LLVM_MINGW_OBJCACHE");
+    if (objcache && *objcache && !getenv("CCACHE")) {
+        if (argc == 2 && !strcmp(argv[1], "--objcache-stats"))
+            return print_objcache_stats(objcache);
+        int ret = try_objcache(objcache, argc, argv, exec_argv, user_args);
+        if (ret >= 0)
+            return ret;
+    }
+
+    const char *driver_cache = getenv("LLVM_MINGW_DRIVER_CACHE");
+    if (driver_cache && *driver_cache && !getenv("CCACHE"))
+        try_driver_cache(driver_cache, argc, argv, exec_argv, user_args);
+
+    if (pch)
+        return run_with_pch(exec_argv, keep, arg);
 #endif
+
+    return run_final_clang(exec_argv, keep);
 }
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2018 Martin Storsjo
+ *
+ * This file is part of llvm-mingw.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// The delay load helper, built into libdelayimp.a by build-delayimp.sh.
+// The first call to a delay loaded function goes through a thunk (made by
+// lld for -delayload:<dll>, or by the dlltool wrapper with -y) that calls
+// __delayLoadHelper2 with the import descriptor of the DLL and the IAT
+// entry of the function. We load the DLL if it isn't loaded yet, look up
+// the function, and store it in the IAT entry, so that later calls go
+// straight to it.
+//
+// This follows the interface of delayimp.lib of MSVC, including the
+// notification and failure hooks, and raises the same exceptions if the
+// DLL or function can't be found.
+
+#include <windows.h>
+
+// Delay import descriptors, with all addresses as RVAs.
+struct delay_descriptor {
+    DWORD attributes;
+    DWORD dll_name;
+    DWORD module_handle;
+    DWORD iat;
+    DWORD int_;
+    DWORD bound_iat;
+    DWORD unload_iat;
+    DWORD timestamp;
+};
+
+#define DELAY_ATTR_RVA 1
+
+// DelayLoadInfo, as passed to the hooks and the exception filters.
+struct delay_load_info {
+    DWORD size;
+    const struct delay_descriptor *descriptor;
+    FARPROC *iat_entry;
+    LPCSTR dll_name;
+    BOOL import_by_name;
+    union {
+        LPCSTR proc_name;
+        DWORD ordinal;
+    };
+    HMODULE module;
+    FARPROC proc;
+    DWORD last_error;
+};
+
+enum {
+    DLI_START_PROCESSING,
+    DLI_NOTE_PRE_LOAD_LIBRARY,
+    DLI_NOTE_PRE_GET_PROC_ADDRESS,
+    DLI_FAIL_LOAD_LIB,
+    DLI_FAIL_GET_PROC,
+    DLI_NOTE_END_PROCESSING,
+};
+
+#define DELAY_EXCEPTION(error) (0xC06D0000 | (error))
+
+typedef FARPROC (WINAPI *dli_hook)(unsigned notify,
+                                   struct delay_load_info *info);
+
+// Common symbols, so that programs can define their own hooks.
+__attribute__((common)) dli_hook __pfnDliNotifyHook2;
+__attribute__((common)) dli_hook __pfnDliFailureHook2;
+
+extern IMAGE_DOS_HEADER __ImageBase;
+
+static FARPROC notify(unsigned event, struct delay_load_info *info) {
+    return __pfnDliNotifyHook2 ? __pfnDliNotifyHook2(event, info) : NULL;
+}
+
+static FARPROC fail(unsigned event, struct delay_load_info *info) {
+    info->last_error = GetLastError();
+    FARPROC ret = __pfnDliFailureHook2 ? __pfnDliFailureHook2(event, info)
+                                       : NULL;
+    if (!ret) {
+        // A handler may fill in info->proc and continue execution.
+        ULONG_PTR arg = (ULONG_PTR) info;
+        RaiseException(DELAY_EXCEPTION(event == DLI_FAIL_LOAD_LIB ?
+                                       ERROR_MOD_NOT_FOUND :
+                                       ERROR_PROC_NOT_FOUND),
+                       0, 1, &arg);
+    }
+    return ret;
+}
+
+FARPROC WINAPI __delayLoadHelper2(const struct delay_descriptor *descriptor,
+                                  FARPROC *iat_entry) {
+    char *base = (char *) &__ImageBase;
+    struct delay_load_info info = {
+        .size = sizeof(info),
+        .descriptor = descriptor,
+        .iat_entry = iat_entry,
+    };
+    if (!(descriptor->attributes & DELAY_ATTR_RVA)) {
+        // Old style descriptors, with pointers instead of RVAs, aren't
+        // made by any current linker.
+        ULONG_PTR arg = (ULONG_PTR) &info;
+        RaiseException(DELAY_EXCEPTION(ERROR_INVALID_PARAMETER), 0, 1, &arg);
+        return NULL;
+    }
+    info.dll_name = base + descriptor->dll_name;
+    HMODULE *module = (HMODULE *) (base + descriptor->module_handle);
+    FARPROC *iat = (FARPROC *) (base + descriptor->iat);
+    const IMAGE_THUNK_DATA *names =
+        (const IMAGE_THUNK_DATA *) (base + descriptor->int_);
+    const IMAGE_THUNK_DATA *name = &names[iat_entry - iat];
+    if (IMAGE_SNAP_BY_ORDINAL(name->u1.Ordinal)) {
+        info.ordinal = IMAGE_ORDINAL(name->u1.Ordinal);
+    } else {
+        info.import_by_name = TRUE;
+        info.proc_name = (LPCSTR) ((const IMAGE_IMPORT_BY_NAME *)
+                                   (base + name->u1.AddressOfData))->Name;
+    }
+    info.module = *module;
+
+    FARPROC proc = notify(DLI_START_PROCESSING, &info);
+    if (proc)
+        goto done;
+
+    HMODULE loaded = info.module;
+    if (!loaded) {
+        loaded = (HMODULE) notify(DLI_NOTE_PRE_LOAD_LIBRARY, &info);
+        if (!loaded)
+            loaded = LoadLibraryA(info.dll_name);
+        if (!loaded)
+            loaded = (HMODULE) fail(DLI_FAIL_LOAD_LIB, &info);
+        if (!loaded)
+            return info.proc;
+        // Another thread may have loaded it at the same time; we only
+        // keep one reference.
+        if (InterlockedExchangePointer((void **) module, loaded) == loaded)
+            FreeLibrary(loaded);
+        info.module = loaded;
+    }
+
+    proc = notify(DLI_NOTE_PRE_GET_PROC_ADDRESS, &info);
+    if (!proc)
+        proc = GetProcAddress(loaded, info.import_by_name ? info.proc_name :
+                              (LPCSTR) (ULONG_PTR) info.ordinal);
+    if (!proc)
+        proc = fail(DLI_FAIL_GET_PROC, &info);
+    if (!proc)
+        return info.proc;
+    *iat_entry = proc;
+
+done:
+    info.proc = proc;
+    info.last_error = 0;
+    notify(DLI_NOTE_END_PROCESSING, &info);
+    return proc;
+}
@@ -0,0 +1,666 @@
+/*
+ * Copyright (c) 2018 Martin Storsjo
+ *
+ * This file is part of llvm-mingw.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "native-wrapper.h"
+
+// Read a whole file, with a terminating NUL. Prints an error and returns
+// NULL if it can't be read.
+static char *read_text_file(const TCHAR *basename, const TCHAR *path) {
+    FILE *f = _tfopen(path, _T("rb"));
+    long len = -1;
+    char *data = NULL;
+    if (f) {
+        if (!fseek(f, 0, SEEK_END))
+            len = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        data = len >= 0 ? malloc(len + 1) : NULL;
+        if (data && fread(data, 1, len, f) != (size_t) len) {
+            free(data);
+            data = NULL;
+        }
+        fclose(f);
+    }
+    if (!data) {
+        _ftprintf(stderr, _T(TS": Unable to read "TS"\n"), basename, path);
+        return NULL;
+    }
+    data[len] = '\0';
+    return data;
+}
+
+// Batch mode: With --batch <manifest>, one import library is generated
+// for each line of the manifest, in the form
+//
+//     foo.def libfoo.a [more llvm-dlltool options]
+//
+// split like response files, with blank lines and lines starting with #
+// skipped. The options given on the command line apply to all of them.
+// llvm-dlltool is run directly for each line, at most LLVM_MINGW_JOBS (by
+// default the number of CPUs) at the same time on unix hosts, respecting
+// make's jobserver; the diagnostics of each are printed in the order of
+// the manifest.
+static int run_batch(const TCHAR *basename, const TCHAR *manifest,
+                     const TCHAR **common, int nb_common) {
+    char *data = read_text_file(basename, manifest);
+    if (!data)
+        return 1;
+
+    const TCHAR ***job_argvs = NULL;
+    int nb_jobs = 0;
+    char *line = data;
+    for (int line_nb = 1; line; line_nb++) {
+        char *end = strchr(line, '\n');
+        if (end)
+            *end++ = '\0';
+        while (*line == ' ' || *line == '\t')
+            line++;
+        if (*line == '#') {
+            line = end;
+            continue;
+        }
+        char **tokens = malloc((strlen(line) / 2 + 1) * sizeof(*tokens));
+        int n = tokenize_response_file(line, strlen(line), tokens);
+        if (n == 1) {
+            _ftprintf(stderr, _T(TS": "TS":%d: missing output library\n"),
+                      basename, manifest, line_nb);
+            return 1;
+        }
+        if (n > 0) {
+            const TCHAR **job_argv = malloc((nb_common + n + 3) *
+                                            sizeof(*job_argv));
+            int arg = 0;
+            for (int i = 0; i < nb_common; i++)
+                job_argv[arg++] = common[i];
+            for (int i = 0; i < n; i++) {
+                if (i < 2)
+                    job_argv[arg++] = i ? _T("-l") : _T("-d");
+#ifdef _UNICODE
+                job_argv[arg++] = escape(utf8_to_tchar(tokens[i]));
+#else
+                job_argv[arg++] = escape(tokens[i]);
+#endif
+            }
+            job_argv[arg] = NULL;
+            job_argvs = realloc(job_argvs, (nb_jobs + 1) * sizeof(*job_argvs));
+            job_argvs[nb_jobs++] = job_argv;
+        }
+        free(tokens);
+        line = end;
+    }
+
+#ifdef _WIN32
+    int ret = 0;
+    for (int job = 0; job < nb_jobs; job++) {
+        int job_ret = _tspawnvp(_P_WAIT, job_argvs[job][0], job_argvs[job]);
+        if (job_ret == -1) {
+            _tperror(job_argvs[job][0]);
+            job_ret = 1;
+        }
+        if (job_ret != 0 && ret == 0)
+            ret = job_ret;
+    }
+    return ret;
+#else
+    return run_parallel(job_argvs, nb_jobs, get_job_limit());
+#endif
+}
+
+// Delay import libraries: With -y <lib> (--output-delaylib), which
+// llvm-dlltool doesn't support, we write a library where each function
+// of the .def file goes through a thunk that loads the DLL and looks up
+// the function on the first call, with __delayLoadHelper2 from
+// libdelayimp.a, like lld does for -delayload:<dll>, but without any
+// options needed when linking. The library asks the linker to pull in
+// libdelayimp.a itself.
+//
+// The library consists of a single object file, written as assembly for
+// the target and assembled by clang, so linking it in keeps the thunks
+// for all the functions of the DLL. Data can't be delay loaded, so DATA
+// exports are left out.
+//
+// The delay import descriptor is plain data in .rdata, only referenced
+// by the thunks; unlike with lld's -delayload:<dll>, nothing makes the
+// linker point the delay import directory of the PE header at it (GNU
+// dlltool's libraries work the same way). So the DLL doesn't show up in
+// the image's imports or delay imports at all, for load-graph-report.py,
+// llvm-readobj --coff-imports or dumpbin /imports. This doesn't matter
+// for __delayLoadHelper2, which is passed the descriptor directly.
+struct delay_export {
+    const char *symbol;
+    const char *import_name; // NULL to import by ordinal
+    int ordinal;
+};
+
+enum delay_arch { DELAY_I686, DELAY_X86_64, DELAY_ARMV7, DELAY_AARCH64 };
+
+// The thunk for a function, jumping to the address in its IAT entry, and
+// the code that the IAT entry initially points to, which passes the
+// address of the entry on to .Ltail. Both are given the name of the IAT
+// entry twice, and the latter also the index of the function first.
+static const char *const delay_thunks[] = {
+    "\tjmpl *%s\n",
+    "\tjmpq *%s(%%rip)\n",
+    "\tmovw r12, :lower16:%s\n"
+    "\tmovt r12, :upper16:%s\n"
+    "\tldr.w pc, [r12]\n",
+    "\tadrp x16, %s\n"
+    "\tldr x16, [x16, :lo12:%s]\n"
+    "\tbr x16\n",
+};
+
+static const char *const delay_loads[] = {
+    ".Lload%d:\n"
+    "\tpushl %%ecx\n"
+    "\tpushl %%edx\n"
+    "\tpushl $%s\n"
+    "\tjmp .Ltail\n",
+    ".Lload%d:\n"
+    "\tleaq %s(%%rip), %%rax\n"
+    "\tjmp .Ltail\n",
+    ".Lload%d:\n"
+    "\tmovw r12, :lower16:%s\n"
+    "\tmovt r12, :upper16:%s\n"
+    "\tb.w .Ltail\n",
+    ".Lload%d:\n"
+    "\tadrp x16, %s\n"
+    "\tadd x16, x16, :lo12:%s\n"
+    "\tb .Ltail\n",
+};
+
+// Calls __delayLoadHelper2(&descriptor, iat_entry), keeping the argument
+// registers of the function intact, and jumps to the function it returns.
+static const char *const delay_tails[] = {
+    "\tpushl $.Ldesc\n"
+    "\tcalll \"___delayLoadHelper2@8\"\n"
+    "\tpopl %edx\n"
+    "\tpopl %ecx\n"
+    "\tjmpl *%eax\n",
+    "\tpushq %rcx\n"
+    "\tpushq %rdx\n"
+    "\tpushq %r8\n"
+    "\tpushq %r9\n"
+    "\tsubq $104, %rsp\n"
+    "\tmovdqa %xmm0, 32(%rsp)\n"
+    "\tmovdqa %xmm1, 48(%rsp)\n"
+    "\tmovdqa %xmm2, 64(%rsp)\n"
+    "\tmovdqa %xmm3, 80(%rsp)\n"
+    "\tmovq %rax, %rdx\n"
+    "\tleaq .Ldesc(%rip), %rcx\n"
+    "\tcallq __delayLoadHelper2\n"
+    "\tmovdqa 32(%rsp), %xmm0\n"
+    "\tmovdqa 48(%rsp), %xmm1\n"
+    "\tmovdqa 64(%rsp), %xmm2\n"
+    "\tmovdqa 80(%rsp), %xmm3\n"
+    "\taddq $104, %rsp\n"
+    "\tpopq %r9\n"
+    "\tpopq %r8\n"
+    "\tpopq %rdx\n"
+    "\tpopq %rcx\n"
+    "\tjmpq *%rax\n",
+    "\tpush.w {r0, r1, r2, r3, r11, lr}\n"
+    "\tvpush {d0, d1, d2, d3, d4, d5, d6, d7}\n"
+    "\tmov r1, r12\n"
+    "\tmovw r0, :lower16:.Ldesc\n"
+    "\tmovt r0, :upper16:.Ldesc\n"
+    "\tbl __delayLoadHelper2\n"
+    "\tmov r12, r0\n"
+    "\tvpop {d0, d1, d2, d3, d4, d5, d6, d7}\n"
+    "\tpop.w {r0, r1, r2, r3, r11, lr}\n"
+    "\tbx r12\n",
+    "\tstp x29, x30, [sp, #-96]!\n"
+    "\tmov x29, sp\n"
+    "\tstp x0, x1, [sp, #16]\n"
+    "\tstp x2, x3, [sp, #32]\n"
+    "\tstp x4, x5, [sp, #48]\n"
+    "\tstp x6, x7, [sp, #64]\n"
+    "\tstr x8, [sp, #80]\n"
+    "\tsub sp, sp, #128\n"
+    "\tstp q0, q1, [sp]\n"
+    "\tstp q2, q3, [sp, #32]\n"
+    "\tstp q4, q5, [sp, #64]\n"
+    "\tstp q6, q7, [sp, #96]\n"
+    "\tmov x1, x16\n"
+    "\tadrp x0, .Ldesc\n"
+    "\tadd x0, x0, :lo12:.Ldesc\n"
+    "\tbl __delayLoadHelper2\n"
+    "\tmov x16, x0\n"
+    "\tldp q0, q1, [sp]\n"
+    "\tldp q2, q3, [sp, #32]\n"
+    "\tldp q4, q5, [sp, #64]\n"
+    "\tldp q6, q7, [sp, #96]\n"
+    "\tadd sp, sp, #128\n"
+    "\tldp x0, x1, [sp, #16]\n"
+    "\tldp x2, x3, [sp, #32]\n"
+    "\tldp x4, x5, [sp, #48]\n"
+    "\tldp x6, x7, [sp, #64]\n"
+    "\tldr x8, [sp, #80]\n"
+    "\tldp x29, x30, [sp], #96\n"
+    "\tbr x16\n",
+};
+
+// A quoted string or symbol name for the assembler.
+static char *asm_quote(const char *prefix, const char *str) {
+    struct buf b = { 0 };
+    buf_append(&b, "\"", 1);
+    buf_append(&b, prefix, strlen(prefix));
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            buf_append(&b, "\\", 1);
+        buf_append(&b, str, 1);
+    }
+    buf_append(&b, "\"", 2);
+    return b.data;
+}
+
+static void write_delay_asm(FILE *f, enum delay_arch arch, const char *dll,
+                            const struct delay_export *exports, int nb) {
+    int ptr64 = arch == DELAY_X86_64 || arch == DELAY_AARCH64;
+    const char *ptr = ptr64 ? ".quad" : ".long";
+
+    // The delay import descriptor, and the import name table.
+    fprintf(f, "\t.section .rdata,\"dr\"\n"
+               "\t.p2align 3\n"
+               ".Ldesc:\n"
+               "\t.long 1\n"
+               "\t.rva .Ldll_name\n"
+               "\t.rva .Lmodule\n"
+               "\t.rva .Liat\n"
+               "\t.rva .Lint\n"
+               "\t.long 0\n"
+               "\t.long 0\n"
+               "\t.long 0\n"
+               ".Lint:\n");
+    for (int i = 0; i < nb; i++) {
+        if (exports[i].import_name)
+            fprintf(f, "\t.rva .Lname%d\n%s", i, ptr64 ? "\t.long 0\n" : "");
+        else if (ptr64)
+            fprintf(f, "\t.quad 0x%llx\n",
+                    0x8000000000000000ULL | exports[i].ordinal);
+        else
+            fprintf(f, "\t.long 0x%x\n", 0x80000000U | exports[i].ordinal);
+    }
+    fprintf(f, "\t%s 0\n", ptr);
+    for (int i = 0; i < nb; i++) {
+        if (!exports[i].import_name)
+            continue;
+        char *name = asm_quote("", exports[i].import_name);
+        fprintf(f, "\t.p2align 1\n.Lname%d:\n\t.short 0\n\t.asciz %s\n",
+                i, name);
+        free(name);
+    }
+    char *name = asm_quote("", dll);
+    fprintf(f, ".Ldll_name:\n\t.asciz %s\n", name);
+    free(name);
+
+    // The module handle, and the IAT, initially pointing at the code that
+    // loads each function.
+    fprintf(f, "\n\t.data\n\t.p2align 3\n.Lmodule:\n\t%s 0\n.Liat:\n", ptr);
+    for (int i = 0; i < nb; i++) {
+        char *imp = asm_quote("__imp_", exports[i].symbol);
+        fprintf(f, "\t.globl %s\n%s:\n\t%s .Lload%d\n", imp, imp, ptr, i);
+        free(imp);
+    }
+    fprintf(f, "\t%s 0\n", ptr);
+
+    fprintf(f, "\n\t.text\n");
+    if (arch == DELAY_ARMV7)
+        fprintf(f, "\t.syntax unified\n\t.thumb\n");
+    fprintf(f, "\t.p2align 2\n");
+    for (int i = 0; i < nb; i++) {
+        char *sym = asm_quote("", exports[i].symbol);
+        char *imp = asm_quote("__imp_", exports[i].symbol);
+        fprintf(f, "\t.globl %s\n\t.def %s; .scl 2; .type 32; .endef\n%s:\n",
+                sym, sym, sym);
+        fprintf(f, delay_thunks[arch], imp, imp);
+        fprintf(f, delay_loads[arch], i, imp, imp);
+        free(sym);
+        free(imp);
+    }
+    fprintf(f, ".Ltail:\n%s", delay_tails[arch]);
+
+    fprintf(f, "\n\t.section .drectve,\"yn\"\n"
+               "\t.ascii \" -defaultlib:libdelayimp.a\"\n");
+}
+
+// Split a line of a .def file into tokens, with = and == as tokens of
+// their own.
+static int split_def_line(char *p, const char **tokens) {
+    int n = 0;
+    while (*p) {
+        if (*p == ' ' || *p == '\t' || *p == '\r') {
+            *p++ = '\0';
+        } else if (*p == '=') {
+            int double_eq = p[1] == '=';
+            *p = '\0';
+            p += 1 + double_eq;
+            tokens[n++] = double_eq ? "==" : "=";
+        } else if (*p == '"') {
+            *p++ = '\0';
+            tokens[n++] = p;
+            while (*p && *p != '"')
+                p++;
+            if (*p)
+                *p++ = '\0';
+        } else {
+            tokens[n++] = p;
+            while (*p && !strchr(" \t\r=\"", *p))
+                p++;
+        }
+    }
+    return n;
+}
+
+static const char *const def_keywords[] = {
+    "LIBRARY", "NAME", "EXPORTS", "HEAPSIZE", "STACKSIZE", "SECTIONS",
+    "VERSION", "DESCRIPTION", NULL
+};
+
+// Read the DLL name and the exports that can be delay loaded from a .def
+// file. Returns the number of exports, or -1 on errors.
+static int read_def(const TCHAR *basename, const TCHAR *path,
+                    enum delay_arch arch, int kill_at, const char **library,
+                    struct delay_export **exports) {
+    char *data = read_text_file(basename, path);
+    if (!data)
+        return -1;
+    const char **tokens = malloc((strlen(data) + 1) * sizeof(*tokens));
+    int nb = 0, in_exports = 0;
+    char *line = data;
+    for (int line_nb = 1; line; line_nb++) {
+        char *end = strchr(line, '\n');
+        if (end)
+            *end++ = '\0';
+        char *comment = strchr(line, ';');
+        if (comment)
+            *comment = '\0';
+        int n = split_def_line(line, tokens);
+        line = end;
+        int t = 0, keyword = 0;
+        for (int i = 0; n > 0 && def_keywords[i]; i++)
+            keyword |= !strcmp(tokens[0], def_keywords[i]);
+        if (keyword) {
+            in_exports = !strcmp(tokens[0], "EXPORTS");
+            if ((!strcmp(tokens[0], "LIBRARY") || !strcmp(tokens[0], "NAME")) &&
+                n > 1)
+                *library = tokens[1];
+            if (!in_exports)
+                continue;
+            t = 1;
+        }
+        if (!in_exports || t >= n)
+            continue;
+
+        // name[=internal name | ==import name] [@ordinal] [NONAME] [DATA]
+        // [PRIVATE]
+        const char *name = tokens[t++];
+        const char *import_name = name;
+        int ordinal = 0, noname = 0, skip = 0;
+        if (t + 1 < n && !strcmp(tokens[t], "=")) {
+            t += 2;
+        } else if (t + 1 < n && !strcmp(tokens[t], "==")) {
+            import_name = tokens[t + 1];
+            t += 2;
+        }
+        for (; t < n; t++) {
+            if (tokens[t][0] == '@')
+                ordinal = atoi(tokens[t][1] || t + 1 == n ? tokens[t] + 1 :
+                                                             tokens[++t]);
+            else if (!strcmp(tokens[t], "NONAME"))
+                noname = 1;
+            else if (!strcmp(tokens[t], "DATA") ||
+                     !strcmp(tokens[t], "CONSTANT") ||
+                     !strcmp(tokens[t], "PRIVATE"))
+                skip = 1;
+        }
+        if (skip)
+            continue;
+        if (noname && !ordinal) {
+            _ftprintf(stderr, _T(TS": "TS":%d: NONAME export without an "
+                                 "ordinal\n"), basename, path, line_nb);
+            return -1;
+        }
+        if (kill_at && import_name == name && name[0] != '?') {
+            // Like llvm-dlltool -k, strip the @<n> suffix of stdcall
+            // functions from the name to look up.
+            char *killed = strdup(name);
+            char *at = strchr(killed + 1, '@');
+            if (at)
+                *at = '\0';
+            import_name = killed;
+        }
+
+        *exports = realloc(*exports, (nb + 1) * sizeof(**exports));
+        struct delay_export *export = &(*exports)[nb++];
+        export->symbol = name;
+        if (arch == DELAY_I686 && name[0] != '@' && name[0] != '?') {
+            char *symbol = malloc(strlen(name) + 2);
+            sprintf(symbol, "_%s", name);
+            export->symbol = symbol;
+        }
+        export->import_name = noname ? NULL : import_name;
+        export->ordinal = ordinal;
+    }
+    free(tokens);
+    return nb;
+}
+
+static int spawn_tool(const TCHAR **argv) {
+    int ret = _tspawnvp(_P_WAIT, argv[0], argv);
+    if (ret == -1) {
+        _tperror(argv[0]);
+        ret = 1;
+    }
+    return ret;
+}
+
+static int make_delaylib(const TCHAR *basename, const TCHAR *dir,
+                         const TCHAR *arch, const TCHAR *def,
+                         const TCHAR *dllname, int kill_at,
+                         const TCHAR *output) {
+    enum delay_arch delay_arch;
+    if (!_tcscmp(arch, _T("i686"))) {
+        delay_arch = DELAY_I686;
+    } else if (!_tcscmp(arch, _T("x86_64"))) {
+        delay_arch = DELAY_X86_64;
+    } else if (!_tcscmp(arch, _T("armv7"))) {
+        delay_arch = DELAY_ARMV7;
+    } else if (!_tcscmp(arch, _T("aarch64"))) {
+        delay_arch = DELAY_AARCH64;
+    } else {
+        _ftprintf(stderr, _T(TS": Delay import libraries aren't supported "
+                             "for "TS"\n"), basename, arch);
+        return 1;
+    }
+
+    const char *library = NULL;
+    struct delay_export *exports = NULL;
+    int nb = read_def(basename, def, delay_arch, kill_at, &library,
+                      &exports);
+    if (nb < 0)
+        return 1;
+    char *dll;
+    if (dllname) {
+#ifdef _UNICODE
+        dll = tchar_to_utf8(dllname);
+#else
+        dll = strdup(dllname);
+#endif
+    } else if (library) {
+        // Like in the linker, a name without an extension gets .dll.
+        dll = malloc(strlen(library) + 5);
+        sprintf(dll, "%s%s", library, strchr(library, '.') ? "" : ".dll");
+    } else {
+        _ftprintf(stderr, _T(TS": No DLL name for "TS"; specify one with "
+                             "-D or in a LIBRARY line\n"), basename, def);
+        return 1;
+    }
+
+    // The object file is named after the library, as the name of its
+    // member.
+    TCHAR *asm_path = create_temp_file(_T("dly"));
+    TCHAR *obj_path = concat(output, _T(".o"));
+    FILE *f = asm_path ? _tfopen(asm_path, _T("w")) : NULL;
+    if (!f) {
+        _ftprintf(stderr, _T(TS": Unable to create a temporary file\n"),
+                  basename);
+        return 1;
+    }
+    write_delay_asm(f, delay_arch, dll, exports, nb);
+    int ret = ferror(f);
+    if (fclose(f) || ret) {
+        _ftprintf(stderr, _T(TS": Unable to write "TS"\n"), basename,
+                  asm_path);
+        ret = 1;
+    }
+
+    if (ret == 0) {
+        TCHAR *prefix = concat(dir, arch);
+        const TCHAR *cc_argv[] = {
+            concat(prefix, _T("-w64-mingw32-clang")), _T("-c"), _T("-x"),
+            _T("assembler"), escape(asm_path), _T("-o"), escape(obj_path),
+            NULL
+        };
+        free(prefix);
+        ret = spawn_tool(cc_argv);
+    }
+    if (ret == 0) {
+        // llvm-ar would add to an existing library.
+        _tunlink(output);
+        const TCHAR *ar_argv[] = {
+            concat(dir, _T("llvm-ar")), _T("rcs"), escape(output),
+            escape(obj_path), NULL
+        };
+        ret = spawn_tool(ar_argv);
+    }
+    _tunlink(asm_path);
+    _tunlink(obj_path);
+    return ret;
+}
+
+// Match an option with a value, as -d value, -dvalue, --input-def value
+// or --input-def=value.
+static const TCHAR *match_value(int argc, TCHAR **argv, int *i,
+                                const TCHAR *short_opt,
+                                const TCHAR *long_opt) {
+    const TCHAR *arg = argv[*i];
+    size_t len = _tcslen(long_opt);
+    if (!_tcsncmp(arg, long_opt, len) && arg[len] == '=')
+        return arg + len + 1;
+    if (!_tcscmp(arg, short_opt) || !_tcscmp(arg, long_opt))
+        return *i + 1 < argc ? argv[++*i] : NULL;
+    if (!_tcsncmp(arg, short_opt, 2) && arg[2])
+        return arg + 2;
+    return NULL;
+}
+
+int _tmain(int argc, TCHAR* argv[]) {
+    const TCHAR *dir;
+    const TCHAR *basename;
+    const TCHAR *target;
+    const TCHAR *exe;
+    split_argv(argv[0], &dir, &basename, &target, &exe);
+    TCHAR *arch = get_arch(target);
+
+    int max_arg = argc + 20;
+    const TCHAR **exec_argv = malloc(max_arg * sizeof(*exec_argv));
+    int arg = 0;
+    exec_argv[arg++] = concat(dir, _T("llvm-dlltool"));
+
+    const TCHAR *machine = NULL;
+    if (!_tcscmp(arch, _T("i686")))
+        machine = _T("i386");
+    else if (!_tcscmp(arch, _T("x86_64")))
+        machine = _T("i386:x86-64");
+    else if (!_tcscmp(arch, _T("armv7")))
+        machine = _T("arm");
+    else if (!_tcscmp(arch, _T("aarch64")))
+        machine = _T("arm64");
+    if (machine) {
+        exec_argv[arg++] = _T("-m");
+        exec_argv[arg++] = machine;
+    }
+
+    const TCHAR *manifest = NULL, *delaylib = NULL, *def = NULL;
+    const TCHAR *dllname = NULL;
+    int kill_at = 0, import_lib = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!_tcscmp(argv[i], _T("--batch")) && i + 1 < argc) {
+            manifest = argv[++i];
+            continue;
+        } else if (!_tcsncmp(argv[i], _T("--batch="), 8)) {
+            manifest = argv[i] + 8;
+            continue;
+        }
+        const TCHAR *value;
+        int start = i;
+        if ((value = match_value(argc, argv, &i, _T("-y"),
+                                 _T("--output-delaylib")))) {
+            delaylib = value;
+            continue;
+        } else if ((value = match_value(argc, argv, &i, _T("-d"),
+                                        _T("--input-def")))) {
+            def = value;
+        } else if ((value = match_value(argc, argv, &i, _T("-D"),
+                                        _T("--dllname")))) {
+            dllname = value;
+        } else if ((value = match_value(argc, argv, &i, _T("-m"),
+                                        _T("--machine")))) {
+            if (!_tcscmp(value, _T("i386")))
+                arch = _T("i686");
+            else if (!_tcscmp(value, _T("i386:x86-64")))
+                arch = _T("x86_64");
+            else if (!_tcscmp(value, _T("arm")))
+                arch = _T("armv7");
+            else if (!_tcscmp(value, _T("arm64")))
+                arch = _T("aarch64");
+        } else if (match_value(argc, argv, &i, _T("-l"),
+                               _T("--output-lib"))) {
+            import_lib = 1;
+        } else if (!_tcscmp(argv[i], _T("-k")) ||
+                   !_tcscmp(argv[i], _T("--kill-at"))) {
+            kill_at = 1;
+        }
+        for (int j = start; j <= i; j++)
+            exec_argv[arg++] = escape(argv[j]);
+    }
+
+    exec_argv[arg] = NULL;
+    if (arg > max_arg) {
+        fprintf(stderr, "Too many options added\n");
+        abort();
+    }
+
+    if (delaylib) {
+        if (manifest || !def) {
+            _ftprintf(stderr, _T(TS": -y needs a .def file (-d), and can't "
+                                 "be used with --batch\n"), basename);
+            return 1;
+        }
+        // A regular import library may be made at the same time.
+        int ret = import_lib ? spawn_tool(exec_argv) : 0;
+        if (ret == 0)
+            ret = make_delaylib(basename, dir, arch, def, dllname, kill_at,
+                                delaylib);
+        return ret;
+    }
+
+    if (manifest)
+        return run_batch(basename, manifest, exec_argv, arg);
+
+    return run_final(exec_argv);
+}
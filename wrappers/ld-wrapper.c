@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2018 Martin Storsjo
+ *
+ * This file is part of llvm-mingw.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "native-wrapper.h"
+
+#ifndef _WIN32
+// Link cache: With LLVM_MINGW_LINK_CACHE=1, the outputs of links are
+// stored in the object cache (LLVM_MINGW_OBJCACHE, see native-wrapper.h),
+// along with the import library, PDB, map and def file they write. The
+// key is a hash of the identity of lld, the working directory, the final
+// command line and the contents of every input: each argument naming a
+// file (objects, archives, import libraries, def files and so on) and
+// each file that an -l option could refer to in the -L directories.
+// Files within the toolchain itself, like the mingw-w64 import libraries,
+// are identified by their stat instead, to avoid hashing them for every
+// link. When the key matches, the outputs are restored from the cache
+// instead of running lld; the warnings printed by the original link
+// aren't repeated.
+
+enum {
+    LINK_OUTPUT, LINK_IMPLIB, LINK_PDB, LINK_MAP, LINK_DEF, NB_LINK_OUTPUTS
+};
+
+static const char *const link_output_suffixes[NB_LINK_OUTPUTS] = {
+    "", "-implib", "-pdb", "-map", "-def"
+};
+
+struct link_cache {
+    const char *dir;
+    char hash[65];
+    const char *outputs[NB_LINK_OUTPUTS];
+};
+
+// Match an option with one or two dashes, as "--name=value" or
+// "--name value", returning the value or NULL.
+static const char *match_option(char **argv, int *i, const char *name) {
+    const char *arg = argv[*i];
+    if (arg[0] != '-')
+        return NULL;
+    arg += arg[1] == '-' ? 2 : 1;
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len))
+        return NULL;
+    if (arg[len] == '=')
+        return arg + len + 1;
+    if (arg[len] == '\0' && argv[*i + 1])
+        return argv[++*i];
+    return NULL;
+}
+
+// Check if a file is in the lib directory or a target directory (e.g.
+// x86_64-w64-mingw32) of the toolchain.
+static int in_toolchain(const char *real, const char *prefix) {
+    size_t len = prefix ? strlen(prefix) : 0;
+    if (!len || strncmp(real, prefix, len) || real[len] != '/')
+        return 0;
+    const char *dir = real + len + 1;
+    const char *end = strchr(dir, '/');
+    if (!end)
+        return 0;
+    if (end - dir == 3 && !strncmp(dir, "lib", 3))
+        return 1;
+    const char *target = strstr(dir, "-w64-mingw32");
+    return target && target < end;
+}
+
+static void hash_link_input(struct sha256 *sha, struct buf *key,
+                            const char *path, const char *prefix) {
+    struct stat st;
+    if (stat(path, &st) || !S_ISREG(st.st_mode))
+        return;
+    char *real = realpath(path, NULL);
+    if (real && in_toolchain(real, prefix)) {
+        buf_append_token(key, path);
+        append_stat_token(key, real);
+    } else {
+        hash_file_contents(sha, path);
+    }
+    free(real);
+}
+
+// Options for lld-link that don't make it write any other files.
+static int cacheable_xlink(const char *value) {
+    return !strncmp(value, "-order:@", 8) || !strcmp(value, "-debug:ghash") ||
+           !strncmp(value, "-delayload:", 11);
+}
+
+// Compute the key for a link. Returns 0 if the link can't be cached.
+static int link_cache_init(struct link_cache *cache, const char **exec_argv) {
+    const char *enable = getenv("LLVM_MINGW_LINK_CACHE");
+    cache->dir = getenv("LLVM_MINGW_OBJCACHE");
+    if (!enable || strcmp(enable, "1") || !cache->dir || !*cache->dir)
+        return 0;
+    memset(cache->outputs, 0, sizeof(cache->outputs));
+
+    int argc = 0;
+    while (exec_argv[argc])
+        argc++;
+    char **argv = malloc((argc + 1) * sizeof(*argv));
+    memcpy(argv, exec_argv, (argc + 1) * sizeof(*argv));
+    expand_response_files(&argc, &argv);
+
+    // Find the outputs; their names are part of the key, but not their
+    // contents from a previous link.
+    char *is_output = calloc(argc, 1);
+    for (int i = 1; i < argc; i++) {
+        int start = i, kind = -1;
+        const char *value;
+        if ((value = match_option(argv, &i, "out-implib")))
+            kind = LINK_IMPLIB;
+        else if ((value = match_option(argv, &i, "output-def")))
+            kind = LINK_DEF;
+        else if ((value = match_option(argv, &i, "Map")))
+            kind = LINK_MAP;
+        else if ((value = match_option(argv, &i, "output")))
+            kind = LINK_OUTPUT;
+        else if ((value = match_option(argv, &i, "pdb")))
+            kind = LINK_PDB;
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            value = argv[++i], kind = LINK_OUTPUT;
+        else if (!strncmp(argv[i], "-o", 2) && argv[i][2])
+            value = argv[i] + 2, kind = LINK_OUTPUT;
+        else if ((value = match_option(argv, &i, "Xlink")) &&
+                 !cacheable_xlink(value))
+            // Options for lld-link may write other files.
+            goto uncacheable;
+        if (kind >= 0) {
+            cache->outputs[kind] = value;
+            memset(is_output + start, 1, i - start + 1);
+        }
+    }
+    if (!cache->outputs[LINK_OUTPUT])
+        cache->outputs[LINK_OUTPUT] = "a.exe";
+    if (cache->outputs[LINK_PDB] && !*cache->outputs[LINK_PDB]) {
+        // An empty name means the output with a .pdb extension.
+        char *path = strdup(cache->outputs[LINK_OUTPUT]);
+        char *dot = strrchr(path, '.');
+        if (dot && !strchr(dot, '/'))
+            *dot = '\0';
+        cache->outputs[LINK_PDB] = concat(path, ".pdb");
+        free(path);
+    }
+    for (int i = 0; i < NB_LINK_OUTPUTS; i++) {
+        struct stat st;
+        if (cache->outputs[i] && (lstat(cache->outputs[i], &st) ?
+                                  errno != ENOENT : !S_ISREG(st.st_mode)))
+            goto uncacheable;
+    }
+
+    struct buf key = { 0 };
+    buf_append_token(&key, "llvm-mingw-linkcache-1");
+    append_tool_identity(&key, argv[0]);
+    char *cwd = getcwd(NULL, 0);
+    buf_append_token(&key, cwd ? cwd : "");
+    free(cwd);
+    for (int i = 1; i < argc; i++)
+        buf_append_token(&key, argv[i]);
+
+    // The toolchain prefix, two levels up from lld.
+    char *lld = find_in_path(argv[0]);
+    char *prefix = lld ? realpath(lld, NULL) : NULL;
+    for (int i = 0; i < 2 && prefix; i++) {
+        char *sep = strrchr(prefix, '/');
+        if (sep)
+            *sep = '\0';
+    }
+    free(lld);
+
+    struct sha256 sha;
+    sha256_init(&sha);
+    const char **lib_dirs = malloc(argc * sizeof(*lib_dirs));
+    const char **libs = malloc(argc * sizeof(*libs));
+    int nb_lib_dirs = 0, nb_libs = 0;
+    for (int i = 1; i < argc; i++) {
+        if (is_output[i])
+            continue;
+        const char *arg = argv[i], *value;
+        if (!strcmp(arg, "-L") && i + 1 < argc) {
+            lib_dirs[nb_lib_dirs++] = argv[++i];
+        } else if (!strncmp(arg, "-L", 2)) {
+            lib_dirs[nb_lib_dirs++] = arg + 2;
+        } else if ((value = match_option(argv, &i, "library-path"))) {
+            lib_dirs[nb_lib_dirs++] = value;
+        } else if (!strcmp(arg, "-l") && i + 1 < argc) {
+            libs[nb_libs++] = argv[++i];
+        } else if (!strncmp(arg, "-l", 2)) {
+            libs[nb_libs++] = arg + 2;
+        } else if ((value = match_option(argv, &i, "library"))) {
+            libs[nb_libs++] = value;
+        } else if ((value = match_option(argv, &i, "Xlink"))) {
+            // Only the options accepted by cacheable_xlink get here.
+            if (!strncmp(value, "-order:@", 8))
+                hash_link_input(&sha, &key, value + 8, prefix);
+        } else {
+            // Any argument, or the value of an option, may be a file.
+            hash_link_input(&sha, &key, arg, prefix);
+            const char *eq = arg[0] == '-' ? strchr(arg, '=') : NULL;
+            if (eq)
+                hash_link_input(&sha, &key, eq + 1, prefix);
+        }
+    }
+    // Rather than repeating the library search of lld, hash every file
+    // that it might pick.
+    static const char *const lib_patterns[] = {
+        "lib%s.dll.a", "%s.dll.a", "lib%s.a", "%s.a", "lib%s.lib", "%s.lib"
+    };
+    for (int i = 0; i < nb_libs; i++) {
+        for (int j = 0; j < nb_lib_dirs; j++) {
+            for (size_t k = 0; k < sizeof(lib_patterns) /
+                                   sizeof(*lib_patterns); k++) {
+                char name[1024];
+                if (libs[i][0] == ':') {
+                    if (k > 0)
+                        break;
+                    snprintf(name, sizeof(name), "%s", libs[i] + 1);
+                } else {
+                    snprintf(name, sizeof(name), lib_patterns[k], libs[i]);
+                }
+                char *path = path_join(lib_dirs[j], name);
+                hash_link_input(&sha, &key, path, prefix);
+                free(path);
+            }
+        }
+    }
+    sha256_update(&sha, key.data, key.len);
+    sha256_final(&sha, cache->hash);
+    free(key.data);
+    free(prefix);
+    free(lib_dirs);
+    free(libs);
+    free(is_output);
+    return 1;
+
+uncacheable:
+    free(is_output);
+    return 0;
+}
+
+// Restore the outputs of a link from the cache. Returns 1 on a hit.
+static int link_cache_get(const struct link_cache *cache) {
+    char name[2] = { cache->hash[0], '\0' };
+    char *shard = path_join(cache->dir, name);
+    char *entry = path_join(shard, cache->hash + 1);
+    char *base = concat(entry, ".link");
+    int hit = 1;
+    for (int i = 0; i < NB_LINK_OUTPUTS && hit; i++) {
+        if (!cache->outputs[i])
+            continue;
+        char *stored = concat(base, link_output_suffixes[i]);
+        hit = copy_file(stored, cache->outputs[i]) >= 0;
+        free(stored);
+    }
+    if (hit) {
+        // lld creates its output as an executable file.
+        mode_t mask = umask(0);
+        umask(mask);
+        chmod(cache->outputs[LINK_OUTPUT], 0777 & ~mask);
+        // Mark the entry as recently used.
+        utimes(base, NULL);
+        update_stats(shard, 1, 0);
+    }
+    free(base);
+    free(entry);
+    free(shard);
+    return hit;
+}
+
+// Record a miss, storing the outputs of a link. The main output is
+// stored last, so that a complete entry exists once it is there.
+static void link_cache_put(const struct link_cache *cache) {
+    char name[2] = { cache->hash[0], '\0' };
+    char *shard = path_join(cache->dir, name);
+    char *entry = path_join(shard, cache->hash + 1);
+    char *base = concat(entry, ".link");
+    mkdir(cache->dir, 0777);
+    mkdir(shard, 0777);
+    long long total = 0;
+    for (int i = NB_LINK_OUTPUTS - 1; i >= 0 && total >= 0; i--) {
+        if (!cache->outputs[i])
+            continue;
+        char *stored = concat(base, link_output_suffixes[i]);
+        long long size = copy_file(cache->outputs[i], stored);
+        total = size < 0 ? -1 : total + size;
+        free(stored);
+    }
+    if (total < 0) {
+        for (int i = 0; i < NB_LINK_OUTPUTS; i++) {
+            char *stored = concat(base, link_output_suffixes[i]);
+            unlink(stored);
+            free(stored);
+        }
+    }
+    update_stats(shard, 0, total > 0 ? total : 0);
+    free(base);
+    free(entry);
+    free(shard);
+}
+#endif
+
+int _tmain(int argc, TCHAR* argv[]) {
+    const TCHAR *dir;
+    const TCHAR *basename;
+    const TCHAR *target;
+    const TCHAR *exe;
+    split_argv(argv[0], &dir, &basename, &target, &exe);
+    TCHAR *arch = get_arch(target);
+
+    if (argc > 1 && !_tcscmp(argv[1], _T("--help"))) {
+        printf(
+"GNU ld impersonation\n"
+"We don't support the --enable-auto-import flag (it's enabled by default just\n"
+"like it is in GNU ld), but we do support the feature itself. Libtool may\n"
+"look for this flag.\n"
+        );
+        return 0;
+    }
+
+    const struct profile *profile = get_profile(dir, target);
+    if (!profile)
+        return 1;
+
+    int max_arg = argc + 20 + profile->nb_ldflags;
+    const TCHAR **exec_argv = malloc(max_arg * sizeof(*exec_argv));
+    int arg = 0;
+    exec_argv[arg++] = concat(dir, _T("ld.lld"));
+
+    if (argc > 1 && !_tcscmp(argv[1], _T("-v"))) {
+        // This isn't implemented in the lld mingw frontend, so don't
+        // pass the -m <machine> option in this case.
+        exec_argv[arg++] = _T("-v");
+        exec_argv[arg] = NULL;
+        return run_final(exec_argv);
+    }
+
+    const TCHAR *machine = NULL;
+    if (!_tcscmp(arch, _T("i686")))
+        machine = _T("i386pe");
+    else if (!_tcscmp(arch, _T("x86_64")))
+        machine = _T("i386pep");
+    else if (!_tcscmp(arch, _T("armv7")))
+        machine = _T("thumb2pe");
+    else if (!_tcscmp(arch, _T("aarch64")))
+        machine = _T("arm64pe");
+    if (machine) {
+        exec_argv[arg++] = _T("-m");
+        exec_argv[arg++] = machine;
+    }
+
+    for (int i = 0; i < profile->nb_ldflags; i++)
+        exec_argv[arg++] = escape(profile->ldflags[i]);
+
+    int threads_set = 0, thinlto_jobs_set = 0, bitcode = 0, lto_cache_set = 0;
+    int delayimp = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!_tcsncmp(argv[i], _T("--threads"), 9))
+            threads_set = 1;
+        else if (!_tcsncmp(argv[i], _T("--thinlto-jobs"), 14))
+            thinlto_jobs_set = 1;
+        else if (!_tcsncmp(argv[i], _T("--thinlto-cache-dir"), 19))
+            lto_cache_set = 1;
+#ifndef _WIN32
+        else if (argv[i][0] != '-' && !bitcode)
+            bitcode = is_bitcode_file(argv[i]);
+#endif
+        if (!_tcsncmp(argv[i], _T("--order-profile="), 16) ||
+            (!_tcscmp(argv[i], _T("--order-profile")) && i + 1 < argc)) {
+            // A symbol ordering file, e.g. from make-order-file.py.
+            const TCHAR *file = argv[i][15] == '=' ? argv[i] + 16 : argv[++i];
+            TCHAR *order = concat(_T("-Xlink=-order:@"), file);
+            exec_argv[arg++] = escape(order);
+            free(order);
+            continue;
+        }
+        if (!_tcsncmp(argv[i], _T("--delayload="), 12) ||
+            (!_tcscmp(argv[i], _T("--delayload")) && i + 1 < argc)) {
+            // Load the DLL on the first call to one of its functions,
+            // through __delayLoadHelper2 from libdelayimp.a.
+            const TCHAR *dll = argv[i][11] == '=' ? argv[i] + 12 : argv[++i];
+            TCHAR *delayload = concat(_T("-Xlink=-delayload:"), dll);
+            exec_argv[arg++] = escape(delayload);
+            free(delayload);
+            delayimp = 1;
+            continue;
+        }
+        exec_argv[arg++] = escape(argv[i]);
+    }
+    if (delayimp)
+        exec_argv[arg++] = _T("-ldelayimp");
+
+    // Merge the types of PDB links by the hashes from -gcodeview-ghash;
+    // this overrides the -debug that lld adds for the PDB.
+    for (int i = 1; i < arg; i++) {
+        if (is_pdb_option(exec_argv[i])) {
+            if (use_ghash_link(dir))
+                exec_argv[arg++] = _T("-Xlink=-debug:ghash");
+            break;
+        }
+    }
+
+#ifndef _WIN32
+    exec_argv[arg] = NULL;
+    struct link_cache link_cache;
+    int link_cached = link_cache_init(&link_cache, exec_argv);
+    if (link_cached && link_cache_get(&link_cache))
+        return 0;
+
+    // When run by the clang wrapper, it already holds the tokens and has
+    // set both options.
+    int threads = 0;
+    if (!threads_set || !thinlto_jobs_set)
+        threads = jobserver_link_threads();
+    char threads_opt[50], thinlto_jobs_opt[50];
+    if (threads > 0) {
+        snprintf(threads_opt, sizeof(threads_opt), "--threads=%d", threads);
+        snprintf(thinlto_jobs_opt, sizeof(thinlto_jobs_opt),
+                 "--thinlto-jobs=%d", threads);
+        if (!threads_set)
+            exec_argv[arg++] = threads_opt;
+        if (!thinlto_jobs_set)
+            exec_argv[arg++] = thinlto_jobs_opt;
+    }
+    char *lto_cache = NULL;
+    if (bitcode && !lto_cache_set)
+        lto_cache = thinlto_cache_dir(target);
+    if (lto_cache) {
+        const char *policy = getenv("LLVM_MINGW_THINLTO_CACHE_POLICY");
+        exec_argv[arg++] = concat("--thinlto-cache-dir=", lto_cache);
+        if (policy && *policy)
+            exec_argv[arg++] = concat("--thinlto-cache-policy=", policy);
+    }
+    if (threads > 0 || lto_cache || link_cached) {
+        exec_argv[arg] = NULL;
+        // Keep running, to give back the jobserver tokens, report on the
+        // ThinLTO cache and store the outputs in the link cache afterwards.
+        int ret;
+        if (lto_cache) {
+            ret = run_thinlto_link(exec_argv, lto_cache);
+        } else {
+            ret = _tspawnvp(_P_WAIT, exec_argv[0], exec_argv);
+            if (ret == -1) {
+                _tperror(exec_argv[0]);
+                ret = 1;
+            }
+        }
+        jobserver_release_all();
+        if (ret == 0 && link_cached)
+            link_cache_put(&link_cache);
+        return ret;
+    }
+#endif
+
+    exec_argv[arg] = NULL;
+    if (arg > max_arg) {
+        fprintf(stderr, "Too many options added\n");
+        abort();
+    }
+
+    return run_final(exec_argv);
+}
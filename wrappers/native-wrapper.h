@@ -0,0 +1,1929 @@
+/*
+ * Copyright (c) 2018 Martin Storsjo
+ *
+ * This file is part of llvm-mingw.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NATIVE_WRAPPER_H
+#define NATIVE_WRAPPER_H
+
+#ifdef UNICODE
+#define _UNICODE
+#endif
+
+#ifndef DEFAULT_TARGET
+#define DEFAULT_TARGET "x86_64-w64-mingw32"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <tchar.h>
+#include <windows.h>
+#include <process.h>
+#define EXECVP_CAST
+#else
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+typedef char TCHAR;
+#define _T(x) x
+#define _tcsrchr strrchr
+#define _tcschr strchr
+#define _tcsdup strdup
+#define _tcscpy strcpy
+#define _tcslen strlen
+#define _tcscmp strcmp
+#define _tcsncmp strncmp
+#define _tperror perror
+#define _texecvp execvp
+#define _tmain main
+#define _tspawnvp _spawnvp
+#define _ftprintf fprintf
+#define _vftprintf vfprintf
+#define _tunlink unlink
+#define _tfopen fopen
+#define _tgetenv getenv
+#define EXECVP_CAST (char **)
+
+#define _P_WAIT 0
+static inline int _spawnvp(int mode, const char *filename, const char * const *argv);
+#endif
+
+#ifdef _UNICODE
+#define TS "%ls"
+#else
+#define TS "%s"
+#endif
+
+static inline TCHAR *escape(const TCHAR *str) {
+#ifdef _WIN32
+    TCHAR *out = malloc((_tcslen(str) * 2 + 3) * sizeof(*out));
+    TCHAR *ptr = out;
+    int i;
+    *ptr++ = '"';
+    for (i = 0; str[i]; i++) {
+        if (str[i] == '"') {
+            int j = i - 1;
+            // Before all double quotes, backslashes need to be escaped, but
+            // not elsewhere.
+            while (j >= 0 && str[j--] == '\\')
+                *ptr++ = '\\';
+            // Escape the next double quote.
+            *ptr++ = '\\';
+        }
+        *ptr++ = str[i];
+    }
+    // Any final backslashes, before the quote around the whole argument,
+    // need to be doubled.
+    int j = i - 1;
+    while (j >= 0 && str[j--] == '\\')
+        *ptr++ = '\\';
+    *ptr++ = '"';
+    *ptr++ = '\0';
+    return out;
+#else
+    return _tcsdup(str);
+#endif
+}
+
+static inline TCHAR *concat(const TCHAR *prefix, const TCHAR *suffix) {
+    int prefixlen = _tcslen(prefix);
+    int suffixlen = _tcslen(suffix);
+    TCHAR *buf = malloc((prefixlen + suffixlen + 1) * sizeof(*buf));
+    _tcscpy(buf, prefix);
+    _tcscpy(buf + prefixlen, suffix);
+    return buf;
+}
+
+static inline TCHAR *_tcsrchrs(const TCHAR *str, TCHAR char1, TCHAR char2) {
+    TCHAR *ptr1 = _tcsrchr(str, char1);
+    TCHAR *ptr2 = _tcsrchr(str, char2);
+    if (!ptr1)
+        return ptr2;
+    if (!ptr2)
+        return ptr1;
+    if (ptr1 < ptr2)
+        return ptr2;
+    return ptr1;
+}
+
+struct buf {
+    char *data;
+    size_t len, size;
+};
+
+static inline void buf_append(struct buf *b, const void *data, size_t len) {
+    if (b->len + len + 1 > b->size) {
+        b->size = (b->len + len + 1) * 2;
+        b->data = realloc(b->data, b->size);
+    }
+    if (len)
+        memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+}
+
+// Append a string including its terminating null, as one token.
+static inline void buf_append_token(struct buf *b, const char *str) {
+    buf_append(b, str, strlen(str) + 1);
+}
+
+
+// SHA-256, for content addressing the object cache.
+struct sha256 {
+    unsigned int state[8];
+    unsigned char block[64];
+    unsigned long long len;
+};
+
+static const unsigned int sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static inline void sha256_block(struct sha256 *s, const unsigned char *p) {
+    unsigned int w[64], t[8];
+    for (int i = 0; i < 16; i++)
+        w[i] = (unsigned int) p[4*i] << 24 | p[4*i+1] << 16 | p[4*i+2] << 8 | p[4*i+3];
+    for (int i = 16; i < 64; i++) {
+        unsigned int s0 = ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3);
+        unsigned int s1 = ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+    memcpy(t, s->state, sizeof(t));
+    for (int i = 0; i < 64; i++) {
+        unsigned int s1 = ROR(t[4], 6) ^ ROR(t[4], 11) ^ ROR(t[4], 25);
+        unsigned int ch = (t[4] & t[5]) ^ (~t[4] & t[6]);
+        unsigned int t1 = t[7] + s1 + ch + sha256_k[i] + w[i];
+        unsigned int s0 = ROR(t[0], 2) ^ ROR(t[0], 13) ^ ROR(t[0], 22);
+        unsigned int maj = (t[0] & t[1]) ^ (t[0] & t[2]) ^ (t[1] & t[2]);
+        memmove(t + 1, t, 7 * sizeof(*t));
+        t[4] += t1;
+        t[0] = t1 + s0 + maj;
+    }
+    for (int i = 0; i < 8; i++)
+        s->state[i] += t[i];
+}
+
+static inline void sha256_init(struct sha256 *s) {
+    static const unsigned int init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(s->state, init, sizeof(init));
+    s->len = 0;
+}
+
+static inline void sha256_update(struct sha256 *s, const void *data, size_t len) {
+    const unsigned char *p = data;
+    while (len > 0) {
+        size_t pos = s->len % 64, n = 64 - pos;
+        if (n > len)
+            n = len;
+        memcpy(s->block + pos, p, n);
+        s->len += n;
+        p += n;
+        len -= n;
+        if (s->len % 64 == 0)
+            sha256_block(s, s->block);
+    }
+}
+
+// Write the digest as a hex string into out, which must hold 65 chars.
+static inline void sha256_final(struct sha256 *s, char *out) {
+    unsigned long long bits = s->len * 8;
+    unsigned char pad[72] = { 0x80 };
+    size_t padlen = (s->len % 64 < 56 ? 56 : 120) - s->len % 64;
+    for (int i = 0; i < 8; i++)
+        pad[padlen + i] = bits >> (56 - 8 * i);
+    sha256_update(s, pad, padlen + 8);
+    for (int i = 0; i < 8; i++)
+        sprintf(out + 8 * i, "%08x", s->state[i]);
+}
+
+#ifndef _WIN32
+static inline char *find_in_path(const char *name) {
+    if (strchr(name, '/'))
+        return strdup(name);
+    const char *path = getenv("PATH");
+    while (path && *path) {
+        const char *end = strchr(path, ':');
+        size_t len = end ? (size_t)(end - path) : strlen(path);
+        char *candidate = malloc(len + strlen(name) + 3);
+        if (len == 0)
+            strcpy(candidate, ".");
+        else
+            memcpy(candidate, path, len), candidate[len] = '\0';
+        strcat(candidate, "/");
+        strcat(candidate, name);
+        if (!access(candidate, X_OK))
+            return candidate;
+        free(candidate);
+        path = end ? end + 1 : NULL;
+    }
+    return NULL;
+}
+
+static inline int read_file(const char *path, struct buf *b) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    char tmp[8192];
+    ssize_t n;
+    while ((n = read(fd, tmp, sizeof(tmp))) > 0)
+        buf_append(b, tmp, n);
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+static inline char *path_join(const char *dir, const char *name) {
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+    sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+// Invocation tracing: With LLVM_MINGW_TRACE set to a directory, the tools
+// run by the wrappers are waited for with wait4(), and one event per tool
+// invocation, in Chrome's trace event format, is appended to
+// <dir>/events.jsonl. The events are merged by trace-report.py.
+static const char *trace_wrapper, *trace_target, *trace_self;
+
+struct trace_child {
+    pid_t pid;
+    const char * const *argv;
+    struct timeval start;
+    struct trace_child *next;
+};
+static struct trace_child *trace_children;
+
+static inline const char *trace_dir(void) {
+    const char *dir = getenv("LLVM_MINGW_TRACE");
+    return dir && *dir ? dir : NULL;
+}
+
+static inline void trace_start(pid_t pid, const char * const *argv) {
+    // Compiles fanned out to ourselves trace their own tools.
+    if (!trace_dir() || (trace_self && !strcmp(argv[0], trace_self)))
+        return;
+    struct trace_child *child = malloc(sizeof(*child));
+    child->pid = pid;
+    child->argv = argv;
+    gettimeofday(&child->start, NULL);
+    child->next = trace_children;
+    trace_children = child;
+}
+
+static inline void json_string(struct buf *b, const char *str) {
+    buf_append(b, "\"", 1);
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\') {
+            buf_append(b, "\\", 1);
+            buf_append(b, str, 1);
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            buf_append(b, esc, 6);
+        } else {
+            buf_append(b, str, 1);
+        }
+    }
+    buf_append(b, "\"", 1);
+}
+
+static inline void trace_end(pid_t pid, int status, const struct rusage *ru) {
+    struct trace_child **ptr = &trace_children;
+    while (*ptr && (*ptr)->pid != pid)
+        ptr = &(*ptr)->next;
+    struct trace_child *child = *ptr;
+    if (!child)
+        return;
+    *ptr = child->next;
+
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    long long start_us = child->start.tv_sec * 1000000LL + child->start.tv_usec;
+    long long end_us = end.tv_sec * 1000000LL + end.tv_usec;
+    long long user_us = ru->ru_utime.tv_sec * 1000000LL + ru->ru_utime.tv_usec;
+    long long sys_us = ru->ru_stime.tv_sec * 1000000LL + ru->ru_stime.tv_usec;
+#ifdef __APPLE__
+    long long maxrss_kb = ru->ru_maxrss / 1024;
+#else
+    long long maxrss_kb = ru->ru_maxrss;
+#endif
+    const char *name = strrchr(child->argv[0], '/');
+    name = name ? name + 1 : child->argv[0];
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd)))
+        strcpy(cwd, "");
+
+    struct buf b = { 0 };
+    char num[200];
+    buf_append(&b, "{\"name\":", 8);
+    json_string(&b, name);
+    buf_append(&b, ",\"cat\":", 7);
+    json_string(&b, trace_target ? trace_target : "");
+    snprintf(num, sizeof(num), ",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+             "\"pid\":%d,\"tid\":%d,\"args\":{\"wrapper\":", start_us,
+             end_us - start_us, (int) getpid(), (int) pid);
+    buf_append(&b, num, strlen(num));
+    json_string(&b, trace_wrapper ? trace_wrapper : "");
+    snprintf(num, sizeof(num), ",\"exit\":%d,\"user_us\":%lld,"
+             "\"sys_us\":%lld,\"maxrss_kb\":%lld,\"cwd\":",
+             WIFEXITED(status) ? WEXITSTATUS(status) :
+             WIFSIGNALED(status) ? -WTERMSIG(status) : -1,
+             user_us, sys_us, maxrss_kb);
+    buf_append(&b, num, strlen(num));
+    json_string(&b, cwd);
+    buf_append(&b, ",\"argv\":[", 9);
+    for (int i = 0; child->argv[i]; i++) {
+        if (i > 0)
+            buf_append(&b, ",", 1);
+        json_string(&b, child->argv[i]);
+    }
+    buf_append(&b, "]}}\n", 4);
+    free(child);
+
+    // A single write with O_APPEND keeps concurrent events intact.
+    const char *dir = trace_dir();
+    mkdir(dir, 0777);
+    char *path = path_join(dir, "events.jsonl");
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666);
+    if (fd >= 0) {
+        if (write(fd, b.data, b.len) != (ssize_t) b.len)
+            fprintf(stderr, "%s: Unable to write trace event\n", path);
+        close(fd);
+    }
+    free(path);
+    free(b.data);
+}
+
+// Wait for a child process, returning the raw status, or -1.
+static inline int wait_traced(pid_t pid) {
+    int status;
+    struct rusage ru;
+    while (wait4(pid, &status, 0, &ru) < 0)
+        if (errno != EINTR)
+            return -1;
+    trace_end(pid, status, &ru);
+    return status;
+}
+
+extern char **environ;
+
+// Start a command with posix_spawn, which unlike fork() doesn't need to
+// duplicate the address space of this process. The entries of fds that
+// aren't -1 become stdin, stdout and stderr of the child; -2 means
+// /dev/null. Returns the pid, or -1 with errno set.
+static inline pid_t spawn_process(const char *file, const char * const *argv,
+                           const int *fds) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    for (int i = 0; fds && i < 3; i++) {
+        if (fds[i] == -2)
+            posix_spawn_file_actions_addopen(&actions, i, "/dev/null",
+                                             i ? O_WRONLY : O_RDONLY, 0);
+        else if (fds[i] >= 0)
+            posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+    }
+    pid_t pid;
+    int err = posix_spawnp(&pid, file, &actions, NULL, (char **) argv,
+                           environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    trace_start(pid, argv);
+    return pid;
+}
+
+// Create a pipe whose ends aren't inherited by other children.
+static inline int pipe_cloexec(int fds[2]) {
+    if (pipe(fds))
+        return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+static inline int _spawnvp(int mode, const char *filename, const char * const *argv) {
+    // Like on Windows, but only _P_WAIT is supported.
+    (void) mode;
+    pid_t pid = spawn_process(filename, argv, NULL);
+    if (pid < 0)
+        return -1;
+    int stat = wait_traced(pid);
+    if (stat == -1)
+        return -1;
+    if (WIFEXITED(stat))
+        return WEXITSTATUS(stat);
+    errno = EIO;
+    return -1;
+}
+
+// Copy a file via a temporary file in the destination directory, which
+// is atomically renamed into place. Returns the number of bytes copied,
+// or -1 on failure.
+static inline long long copy_file(const char *src, const char *dest) {
+    int in = open(src, O_RDONLY);
+    if (in < 0)
+        return -1;
+    char *tmp = malloc(strlen(dest) + 30);
+    sprintf(tmp, "%s.%d.tmp", dest, (int) getpid());
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out < 0) {
+        close(in);
+        free(tmp);
+        return -1;
+    }
+    char block[65536];
+    long long total = 0;
+    ssize_t n;
+    while ((n = read(in, block, sizeof(block))) > 0) {
+        if (write(out, block, n) != n) {
+            n = -1;
+            break;
+        }
+        total += n;
+    }
+    close(in);
+    if (close(out) || n < 0 || rename(tmp, dest)) {
+        unlink(tmp);
+        total = -1;
+    }
+    free(tmp);
+    return total;
+}
+
+static inline int write_file(const char *path, const struct buf *b) {
+    char *tmp = malloc(strlen(path) + 30);
+    sprintf(tmp, "%s.%d.tmp", path, (int) getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int ret = -1;
+    if (fd >= 0) {
+        int ok = write(fd, b->data, b->len) == (ssize_t) b->len;
+        if (!close(fd) && ok && !rename(tmp, path))
+            ret = 0;
+        else
+            unlink(tmp);
+    }
+    free(tmp);
+    return ret;
+}
+
+// Start a command with the given file descriptor (stdout or stderr)
+// redirected to a pipe, and optionally the other one to /dev/null.
+static inline pid_t spawn_piped(const char **argv, int piped_fd, int null_fd,
+                         int *read_fd) {
+    int fds[2];
+    if (pipe_cloexec(fds))
+        return -1;
+    int child_fds[3] = { -1, -1, -1 };
+    child_fds[piped_fd] = fds[1];
+    if (null_fd >= 0)
+        child_fds[null_fd] = -2;
+    pid_t pid = spawn_process(argv[0], argv, child_fds);
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+    *read_fd = fds[0];
+    return pid;
+}
+
+// Wait for a child process, returning its exit code or -1.
+static inline int wait_child(pid_t pid) {
+    int status = wait_traced(pid);
+    if (status == -1)
+        return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static inline void read_all(int fd, struct buf *out) {
+    char tmp[8192];
+    ssize_t n;
+    while ((n = read(fd, tmp, sizeof(tmp))) != 0) {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            break;
+        buf_append(out, tmp, n);
+    }
+    close(fd);
+}
+
+// Run a command with stderr captured, returning its exit code or -1.
+static inline int capture_stderr(const char **argv, int null_stdout,
+                          struct buf *out) {
+    int fd;
+    pid_t pid = spawn_piped(argv, 2, null_stdout ? 1 : -1, &fd);
+    if (pid < 0)
+        return -1;
+    read_all(fd, out);
+    return wait_child(pid);
+}
+
+// Client for the GNU make jobserver, as advertised by make in MAKEFLAGS
+// with --jobserver-auth=R,W (or --jobserver-fds=R,W for older versions,
+// or --jobserver-auth=fifo:PATH since make 4.4). Like every job started
+// by make, we implicitly hold one token; additional ones are read from
+// the jobserver and must be written back when no longer used.
+static int jobserver_rfd = -1, jobserver_wfd = -1;
+static char jobserver_tokens[256];
+static volatile int jobserver_held;
+
+static inline void jobserver_release_all(void) {
+    while (jobserver_held > 0) {
+        char token = jobserver_tokens[--jobserver_held];
+        while (write(jobserver_wfd, &token, 1) < 0 && errno == EINTR)
+            ;
+    }
+}
+
+static inline void jobserver_signal(int sig) {
+    jobserver_release_all();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// Returns 1 if a jobserver is available.
+static inline int jobserver_init(void) {
+    if (jobserver_rfd >= 0)
+        return 1;
+    const char *flags = getenv("MAKEFLAGS");
+    if (!flags)
+        return 0;
+    const char *auth = NULL, *opt;
+    // Later options override earlier ones.
+    for (opt = flags; (opt = strstr(opt, "--jobserver-")); opt++) {
+        if (!strncmp(opt, "--jobserver-auth=", 17))
+            auth = opt + 17;
+        else if (!strncmp(opt, "--jobserver-fds=", 16))
+            auth = opt + 16;
+    }
+    if (!auth)
+        return 0;
+    int rfd = -1, wfd = -1;
+    if (!strncmp(auth, "fifo:", 5)) {
+        char *path = strdup(auth + 5);
+        path[strcspn(path, " ")] = '\0';
+        rfd = wfd = open(path, O_RDWR | O_NONBLOCK);
+        free(path);
+    } else {
+        int r, w;
+        if (sscanf(auth, "%d,%d", &r, &w) != 2 || r < 0 || w < 0)
+            return 0;
+        // The file descriptors are only inherited for recipes that make
+        // considers recursive.
+        if (fcntl(r, F_GETFD) < 0 || fcntl(w, F_GETFD) < 0)
+            return 0;
+        wfd = w;
+        // Reopen the pipe to get a file description of our own that can
+        // be made non-blocking, without affecting make or other jobs.
+        char path[50];
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", r);
+        rfd = open(path, O_RDONLY | O_NONBLOCK);
+        if (rfd < 0)
+            rfd = dup(r);
+    }
+    if (rfd < 0 || wfd < 0)
+        return 0;
+    jobserver_rfd = rfd;
+    jobserver_wfd = wfd;
+    signal(SIGINT, jobserver_signal);
+    signal(SIGTERM, jobserver_signal);
+    signal(SIGHUP, jobserver_signal);
+    return 1;
+}
+
+// Try to get one more token without blocking. Returns 1 on success.
+static inline int jobserver_acquire(void) {
+    if (jobserver_rfd < 0 ||
+        jobserver_held >= (int) sizeof(jobserver_tokens))
+        return 0;
+    // If we couldn't get a non-blocking file description, check that the
+    // pipe is readable first, to avoid blocking in most cases.
+    if (!(fcntl(jobserver_rfd, F_GETFL) & O_NONBLOCK)) {
+        struct pollfd pfd = { jobserver_rfd, POLLIN, 0 };
+        if (poll(&pfd, 1, 0) <= 0)
+            return 0;
+    }
+    char token;
+    if (read(jobserver_rfd, &token, 1) != 1)
+        return 0;
+    jobserver_tokens[jobserver_held++] = token;
+    return 1;
+}
+
+static inline void jobserver_release(void) {
+    if (jobserver_held <= 0)
+        return;
+    char token = jobserver_tokens[--jobserver_held];
+    while (write(jobserver_wfd, &token, 1) < 0 && errno == EINTR)
+        ;
+}
+
+// Check if we run under a parallel make (-jN with N > 1, or -j) whose
+// jobserver we can't use. make 4.3 and older only let recipes that it
+// considers recursive (marked with "+" or running $(MAKE)) inherit the
+// jobserver file descriptors, but still pass -jN to all of them.
+static inline int make_without_jobserver(void) {
+    const char *flags = getenv("MAKEFLAGS");
+    if (!flags || jobserver_init())
+        return 0;
+    for (const char *opt = flags; (opt = strstr(opt, "-j")); opt++) {
+        if (opt != flags && opt[-1] != ' ')
+            continue;
+        if (opt[2] == '\0' || opt[2] == ' ')
+            return 1;
+        if (opt[2] >= '0' && opt[2] <= '9' && atoi(opt + 2) > 1)
+            return 1;
+    }
+    return 0;
+}
+
+// For links, when LLVM_MINGW_LINK_JOBSERVER is set and we run under a make
+// jobserver: Grab as many tokens as are available right away (up to the
+// number of CPUs), and return the number of threads the linker may use,
+// or 0 if it shouldn't be limited. The tokens are held until the linker
+// has finished. Under a parallel make without a usable jobserver, the
+// linker gets a single thread. This requires an lld that supports
+// --threads=N and --thinlto-jobs=N.
+static inline int jobserver_link_threads(void) {
+    const char *env = getenv("LLVM_MINGW_LINK_JOBSERVER");
+    if (!env || !*env || !strcmp(env, "0"))
+        return 0;
+    if (!jobserver_init())
+        return make_without_jobserver() ? 1 : 0;
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    while (jobserver_held + 1 < cpus && jobserver_acquire())
+        ;
+    return jobserver_held + 1;
+}
+
+// The number of jobs to run in parallel: LLVM_MINGW_JOBS, or by default
+// the number of CPUs. Under a parallel make without a usable jobserver,
+// make already runs as many jobs as it was asked to, so run serially.
+static inline int get_job_limit(void) {
+    if (make_without_jobserver())
+        return 1;
+    const char *str = getenv("LLVM_MINGW_JOBS");
+    int jobs = str ? atoi(str) : 0;
+    if (jobs <= 0)
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    return jobs > 0 ? jobs : 1;
+}
+
+struct parallel_job {
+    pid_t pid;
+    int fd;
+    int done;
+    int ret;
+    struct buf err;
+};
+
+// Run the commands in argvs, at most limit of them at the same time.
+// When run by make with a jobserver, each command apart from the first
+// one also needs a token from the jobserver. The stderr output of each
+// command is collected and printed in the order of argvs. Returns the
+// first nonzero exit code, or 0.
+static inline int run_parallel(const char ***argvs, int nb_jobs, int limit) {
+    struct parallel_job *jobs = calloc(nb_jobs, sizeof(*jobs));
+    struct pollfd *fds = malloc((nb_jobs + 1) * sizeof(*fds));
+    int *fd_jobs = malloc(nb_jobs * sizeof(*fd_jobs));
+    int started = 0, running = 0, printed = 0, ret = 0;
+    int jobserver = jobserver_init();
+
+    while (printed < nb_jobs) {
+        while (running < limit && started < nb_jobs) {
+            if (jobserver && running > 0 && !jobserver_acquire())
+                break;
+            struct parallel_job *job = &jobs[started];
+            job->pid = spawn_piped(argvs[started], 2, -1, &job->fd);
+            if (job->pid < 0) {
+                perror(argvs[started][0]);
+                job->fd = -1;
+                job->done = 1;
+                job->ret = 1;
+                if (running > 0)
+                    jobserver_release();
+            } else {
+                running++;
+            }
+            started++;
+        }
+
+        int nb_fds = 0;
+        for (int i = printed; i < started; i++) {
+            if (jobs[i].fd < 0)
+                continue;
+            fds[nb_fds].fd = jobs[i].fd;
+            fds[nb_fds].events = POLLIN;
+            fd_jobs[nb_fds++] = i;
+        }
+        int waiting = nb_fds;
+        if (jobserver && running < limit && started < nb_jobs) {
+            // Also wait for a token to become available.
+            fds[nb_fds].fd = jobserver_rfd;
+            fds[nb_fds++].events = POLLIN;
+        }
+        if (nb_fds > 0 && poll(fds, nb_fds, -1) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        for (int i = 0; i < waiting; i++) {
+            struct parallel_job *job = &jobs[fd_jobs[i]];
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            char block[8192];
+            ssize_t n = read(job->fd, block, sizeof(block));
+            if (n > 0) {
+                buf_append(&job->err, block, n);
+            } else if (n == 0 || errno != EINTR) {
+                close(job->fd);
+                job->fd = -1;
+                job->ret = wait_child(job->pid);
+                job->done = 1;
+                running--;
+                // The first running command uses our implicit token.
+                while (jobserver_held > 0 && jobserver_held >= running)
+                    jobserver_release();
+            }
+        }
+
+        while (printed < nb_jobs && jobs[printed].done) {
+            struct parallel_job *job = &jobs[printed++];
+            if (job->err.len)
+                fwrite(job->err.data, 1, job->err.len, stderr);
+            if (job->ret != 0 && ret == 0)
+                ret = job->ret < 0 ? 1 : job->ret;
+            free(job->err.data);
+        }
+    }
+    jobserver_release_all();
+    free(fd_jobs);
+    free(fds);
+    free(jobs);
+    return ret;
+}
+
+static inline void append_stat_token(struct buf *key, const char *path) {
+    struct stat st;
+    char str[100];
+    if (stat(path, &st))
+        memset(&st, 0, sizeof(st));
+    snprintf(str, sizeof(str), "%lld %lld %llu", (long long) st.st_size,
+             (long long) st.st_mtime, (unsigned long long) st.st_ino);
+    buf_append_token(key, str);
+}
+
+// Identify a tool by its real path and the stat of it.
+static inline void append_tool_identity(struct buf *key, const char *tool) {
+    char *path = find_in_path(tool);
+    char *real = path ? realpath(path, NULL) : NULL;
+    buf_append_token(key, real ? real : tool);
+    if (real)
+        append_stat_token(key, real);
+    free(real);
+    free(path);
+}
+
+// Hash the path and contents of a file, if it is a regular file.
+static inline void hash_file_contents(void *opaque, const char *path) {
+    struct sha256 *sha = opaque;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0)
+        return;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return;
+    }
+    sha256_update(sha, path, strlen(path) + 1);
+    char block[65536];
+    ssize_t n;
+    while ((n = read(fd, block, sizeof(block))) > 0)
+        sha256_update(sha, block, n);
+    close(fd);
+    sha256_update(sha, "", 1);
+}
+
+// Object cache store, in the LLVM_MINGW_OBJCACHE directory, shared by
+// the clang, windres and ld wrappers. Outputs are stored under a hash of
+// everything that went into them, with the extension of the kind of
+// output (".o", ".res" or ".link"), along with the diagnostics that were
+// printed (in a file with "err" appended to the name). Links also store
+// their side products, in files with "-implib", "-pdb", "-map" or "-def"
+// appended to the name.
+//
+// The store is split into 16 shards (subdirectories named after the first
+// hex digit of the hash), each with a "stats" file holding its counters,
+// updated under a lock. Each shard is limited to 1/16 of
+// LLVM_MINGW_OBJCACHE_SIZE (default 5G); when exceeded, the least recently
+// used entries of the shard are removed. All files are written to
+// temporary names and renamed into place.
+
+#define OBJCACHE_SHARDS 16
+
+struct objcache_stats {
+    unsigned long long hits, misses, files, size;
+};
+
+static inline unsigned long long objcache_max_size(void) {
+    const char *str = getenv("LLVM_MINGW_OBJCACHE_SIZE");
+    unsigned long long size = 5ULL << 30;
+    if (str && *str) {
+        char *end;
+        size = strtoull(str, &end, 10);
+        switch (*end) {
+        case 'G': case 'g': size <<= 10; // fallthrough
+        case 'M': case 'm': size <<= 10; // fallthrough
+        case 'K': case 'k': size <<= 10; break;
+        }
+    }
+    return size;
+}
+
+static inline int open_locked_stats(const char *shard) {
+    char *path = path_join(shard, "stats");
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    free(path);
+    if (fd < 0)
+        return -1;
+    struct flock lock = { 0 };
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &lock) < 0) {
+        if (errno != EINTR) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static inline void read_stats(int fd, struct objcache_stats *stats) {
+    char str[200];
+    ssize_t n = pread(fd, str, sizeof(str) - 1, 0);
+    memset(stats, 0, sizeof(*stats));
+    if (n <= 0)
+        return;
+    str[n] = '\0';
+    sscanf(str, "%llu %llu %llu %llu", &stats->hits, &stats->misses,
+           &stats->files, &stats->size);
+}
+
+static inline void write_stats(int fd, const struct objcache_stats *stats) {
+    char str[200];
+    int n = snprintf(str, sizeof(str), "%llu %llu %llu %llu\n", stats->hits,
+                     stats->misses, stats->files, stats->size);
+    if (ftruncate(fd, 0) == 0 && pwrite(fd, str, n, 0) != n)
+        ftruncate(fd, 0);
+}
+
+static const char *const objcache_extra_suffixes[] = {
+    "err", "-dep", "-implib", "-pdb", "-map", "-def", NULL
+};
+
+struct cache_file {
+    char *name;
+    time_t mtime;
+    unsigned long long size;
+};
+
+static inline int compare_mtime(const void *a, const void *b) {
+    const struct cache_file *fa = a, *fb = b;
+    return fa->mtime < fb->mtime ? -1 : fa->mtime > fb->mtime;
+}
+
+// Remove the least recently used entries from a shard until it is below
+// 90% of its limit, and recount its contents. Called with the shard's
+// stats lock held.
+static inline void clean_shard(const char *shard, unsigned long long limit,
+                        struct objcache_stats *stats) {
+    DIR *d = opendir(shard);
+    if (!d)
+        return;
+    struct cache_file *files = NULL;
+    int nb_files = 0, max_files = 0;
+    struct dirent *ent;
+    unsigned long long total = 0;
+    while ((ent = readdir(d))) {
+        const char *ext = strrchr(ent->d_name, '.');
+        if (!ext || (strcmp(ext, ".o") && strcmp(ext, ".res") &&
+                     strcmp(ext, ".link")))
+            continue;
+        struct stat st;
+        char *path = path_join(shard, ent->d_name);
+        if (stat(path, &st)) {
+            free(path);
+            continue;
+        }
+        if (nb_files == max_files) {
+            max_files = max_files * 2 + 16;
+            files = realloc(files, max_files * sizeof(*files));
+        }
+        files[nb_files].name = path;
+        files[nb_files].mtime = st.st_mtime;
+        files[nb_files].size = st.st_size;
+        // Include the size of the stored diagnostics and side products.
+        for (int j = 0; objcache_extra_suffixes[j]; j++) {
+            char *extra = concat(path, objcache_extra_suffixes[j]);
+            if (!stat(extra, &st))
+                files[nb_files].size += st.st_size;
+            free(extra);
+        }
+        total += files[nb_files].size;
+        nb_files++;
+    }
+    closedir(d);
+    qsort(files, nb_files, sizeof(*files), compare_mtime);
+    int i;
+    for (i = 0; i < nb_files && total > limit / 10 * 9; i++) {
+        unlink(files[i].name);
+        for (int j = 0; objcache_extra_suffixes[j]; j++) {
+            char *extra = concat(files[i].name, objcache_extra_suffixes[j]);
+            unlink(extra);
+            free(extra);
+        }
+        total -= files[i].size;
+        free(files[i].name);
+    }
+    stats->files = nb_files - i;
+    stats->size = total;
+    for (; i < nb_files; i++)
+        free(files[i].name);
+    free(files);
+}
+
+static inline void update_stats(const char *shard, int hit, unsigned long long added) {
+    int fd = open_locked_stats(shard);
+    if (fd < 0)
+        return;
+    struct objcache_stats stats;
+    read_stats(fd, &stats);
+    if (hit) {
+        stats.hits++;
+    } else {
+        stats.misses++;
+        if (added) {
+            stats.files++;
+            stats.size += added;
+        }
+        unsigned long long limit = objcache_max_size() / OBJCACHE_SHARDS;
+        if (stats.size > limit)
+            clean_shard(shard, limit, &stats);
+    }
+    write_stats(fd, &stats);
+    close(fd);
+}
+
+static inline int print_objcache_stats(const char *cache_dir) {
+    struct objcache_stats total = { 0 };
+    for (int i = 0; i < OBJCACHE_SHARDS; i++) {
+        char name[2] = { "0123456789abcdef"[i], '\0' };
+        char *shard = path_join(cache_dir, name);
+        char *path = path_join(shard, "stats");
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            struct objcache_stats stats;
+            read_stats(fd, &stats);
+            close(fd);
+            total.hits += stats.hits;
+            total.misses += stats.misses;
+            total.files += stats.files;
+            total.size += stats.size;
+        }
+        free(path);
+        free(shard);
+    }
+    unsigned long long lookups = total.hits + total.misses;
+    printf("cache directory   %s\n", cache_dir);
+    printf("cache hits        %llu\n", total.hits);
+    printf("cache misses      %llu\n", total.misses);
+    printf("hit rate          %.1f %%\n",
+           lookups ? 100.0 * total.hits / lookups : 0.0);
+    printf("files in cache    %llu\n", total.files);
+    printf("cache size        %.1f MB\n", total.size / 1048576.0);
+    printf("max cache size    %.1f MB\n", objcache_max_size() / 1048576.0);
+    return 0;
+}
+
+// Copy the entry for hash to output_path and replay its diagnostics. If
+// deps is set, the stored dependency information is read into it, and
+// entries without it are misses. Returns 1 on a hit, 0 on a miss.
+static inline int objcache_get(const char *cache_dir, const char *hash,
+                        const char *ext, const char *output_path,
+                        struct buf *deps) {
+    char name[2] = { hash[0], '\0' };
+    char *shard = path_join(cache_dir, name);
+    char *entry = path_join(shard, hash + 1);
+    char *object = concat(entry, ext);
+    char *diags = concat(object, "err");
+    int hit = 1;
+    if (deps) {
+        char *stored = concat(object, "-dep");
+        hit = !read_file(stored, deps);
+        free(stored);
+    }
+    hit = hit && copy_file(object, output_path) >= 0;
+    if (hit) {
+        struct buf err = { 0 };
+        read_file(diags, &err);
+        if (err.len)
+            fwrite(err.data, 1, err.len, stderr);
+        free(err.data);
+        // Mark the entry as recently used.
+        utimes(object, NULL);
+        update_stats(shard, 1, 0);
+    }
+    free(diags);
+    free(object);
+    free(entry);
+    free(shard);
+    return hit;
+}
+
+// Record a miss, storing output_path, the diagnostics and the dependency
+// information (if any) as the entry for hash.
+static inline void objcache_put(const char *cache_dir, const char *hash,
+                         const char *ext, const char *output_path,
+                         const struct buf *err, const struct buf *deps) {
+    char name[2] = { hash[0], '\0' };
+    char *shard = path_join(cache_dir, name);
+    char *entry = path_join(shard, hash + 1);
+    char *object = concat(entry, ext);
+    char *diags = concat(object, "err");
+    char *stored = concat(object, "-dep");
+    long long size = -1;
+    mkdir(cache_dir, 0777);
+    mkdir(shard, 0777);
+    struct buf empty = { 0 };
+    if (!err)
+        err = &empty;
+    if (!write_file(diags, err) && (!deps || !write_file(stored, deps))) {
+        size = copy_file(output_path, object);
+        if (size < 0) {
+            unlink(diags);
+            unlink(stored);
+        } else {
+            size += err->len + (deps ? deps->len : 0);
+        }
+    }
+    update_stats(shard, 0, size > 0 ? size : 0);
+    free(stored);
+    free(diags);
+    free(object);
+    free(entry);
+    free(shard);
+}
+
+// ThinLTO cache: With LLVM_MINGW_THINLTO_CACHE set, links with ThinLTO
+// get a per-target cache directory, LLVM_MINGW_THINLTO_CACHE/<target> (or
+// under ~/.cache/llvm-mingw/thinlto if it is set to 1), so that relinks
+// don't redo the codegen of unchanged modules. lld prunes the cache after
+// each link, according to its default policy or
+// LLVM_MINGW_THINLTO_CACHE_POLICY (e.g. "prune_after=72h:
+// cache_size_bytes=4g"). This is opt-in, as the lld version pinned in
+// build-llvm.sh may not support --thinlto-cache-dir.
+static inline int mkdir_p(const char *path) {
+    char *copy = strdup(path);
+    for (char *ptr = copy + 1; *ptr; ptr++) {
+        if (*ptr != '/')
+            continue;
+        *ptr = '\0';
+        mkdir(copy, 0777);
+        *ptr = '/';
+    }
+    int ret = mkdir(copy, 0777) && errno != EEXIST ? -1 : 0;
+    free(copy);
+    return ret;
+}
+
+static inline char *thinlto_cache_dir(const char *target) {
+    const char *env = getenv("LLVM_MINGW_THINLTO_CACHE");
+    char *root;
+    if (!env || !*env || !strcmp(env, "0"))
+        return NULL;
+    if (strcmp(env, "1")) {
+        root = strdup(env);
+    } else {
+        const char *base = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+        if (base && *base)
+            root = path_join(base, "llvm-mingw/thinlto");
+        else if (home && *home)
+            root = path_join(home, ".cache/llvm-mingw/thinlto");
+        else
+            return NULL;
+    }
+    char *dir = path_join(root, target);
+    free(root);
+    if (mkdir_p(dir)) {
+        free(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+// Check if an object file, or the first member of an archive, is LLVM
+// bitcode, i.e. if linking it involves LTO.
+static inline int is_bitcode_file(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    unsigned char data[68];
+    ssize_t n = read(fd, data, 8);
+    int ret = 0;
+    if (n >= 4 && !memcmp(data, "BC\xc0\xde", 4)) {
+        ret = 1;
+    } else if (n == 8 && !memcmp(data, "!<arch>\n", 8)) {
+        // Skip the symbol table and long name members.
+        off_t offset = 8;
+        for (int i = 0; i < 4; i++) {
+            if (pread(fd, data, 64, offset) != 64)
+                break;
+            long size = strtol((const char *) data + 48, NULL, 10);
+            if (data[0] != '/' && memcmp(data, "__.SYMDEF", 9)) {
+                ret = !memcmp(data + 60, "BC\xc0\xde", 4);
+                break;
+            }
+            offset += 60 + size + (size & 1);
+        }
+    }
+    close(fd);
+    return ret;
+}
+
+struct cache_names {
+    char **names;
+    int nb_names;
+};
+
+static inline void cache_names_add(struct cache_names *list, const char *name) {
+    for (int i = 0; i < list->nb_names; i++)
+        if (!strcmp(list->names[i], name))
+            return;
+    list->names = realloc(list->names,
+                          (list->nb_names + 1) * sizeof(*list->names));
+    list->names[list->nb_names++] = strdup(name);
+}
+
+static inline int cache_names_find(const struct cache_names *list, const char *name) {
+    for (int i = 0; i < list->nb_names; i++)
+        if (!strcmp(list->names[i], name))
+            return 1;
+    return 0;
+}
+
+static inline void list_cache_entries(const char *dir, struct cache_names *list) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    while (d && (entry = readdir(d)))
+        if (!strncmp(entry->d_name, "llvmcache-", 10))
+            cache_names_add(list, entry->d_name);
+    if (d)
+        closedir(d);
+}
+
+// Run a link that uses the ThinLTO cache in dir, and report how many
+// modules were found in the cache. New entries (misses) are found by
+// comparing the directory before and after the link; on Linux, entries
+// read by lld (hits) are caught with inotify.
+static inline int run_thinlto_link(const char **argv, const char *dir) {
+    struct cache_names before = { 0 }, opened = { 0 }, after = { 0 };
+    list_cache_entries(dir, &before);
+    int ifd = -1;
+#ifdef __linux__
+    ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd >= 0 && inotify_add_watch(ifd, dir, IN_OPEN) < 0) {
+        close(ifd);
+        ifd = -1;
+    }
+#endif
+    int watched = ifd >= 0;
+    pid_t pid = spawn_process(argv[0], argv, NULL);
+    if (pid < 0) {
+        perror(argv[0]);
+        return 1;
+    }
+#ifdef __linux__
+    while (ifd >= 0) {
+        char events[4096]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+        struct pollfd pfd = { ifd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, 50);
+        ssize_t n = ready > 0 ? read(ifd, events, sizeof(events)) : 0;
+        for (char *ptr = events; ptr < events + n; ) {
+            struct inotify_event *event = (struct inotify_event *) ptr;
+            if (event->len && !strncmp(event->name, "llvmcache-", 10))
+                cache_names_add(&opened, event->name);
+            ptr += sizeof(*event) + event->len;
+        }
+        siginfo_t info = { 0 };
+        if (n <= 0 && !waitid(P_PID, pid, &info,
+                               WEXITED | WNOHANG | WNOWAIT) &&
+            info.si_pid == pid)
+            break;
+    }
+    if (ifd >= 0)
+        close(ifd);
+#endif
+    int status = wait_traced(pid);
+    int ret = status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+    list_cache_entries(dir, &after);
+    int hits = 0, misses = 0;
+    for (int i = 0; i < after.nb_names; i++)
+        if (!cache_names_find(&before, after.names[i]))
+            misses++;
+    for (int i = 0; i < opened.nb_names; i++)
+        if (cache_names_find(&before, opened.names[i]))
+            hits++;
+    if (ret == 0 && watched && hits + misses > 0)
+        fprintf(stderr, "ThinLTO cache: %d hits, %d misses (%d%% hit rate)\n",
+                hits, misses, 100 * hits / (hits + misses));
+    else if (ret == 0 && misses > 0)
+        fprintf(stderr, "ThinLTO cache: %d new entries\n", misses);
+    return ret;
+}
+#endif
+
+// Split argv[0] into the directory of the executable, and the target
+// triple and tool name from the "<target>-<exe>" basename.
+static inline void split_argv(const TCHAR *argv0, const TCHAR **dir_ptr,
+                       const TCHAR **basename_ptr, const TCHAR **target_ptr,
+                       const TCHAR **exe_ptr) {
+    const TCHAR *sep = _tcsrchrs(argv0, '/', '\\');
+    TCHAR *dir = _tcsdup(_T(""));
+    const TCHAR *basename = argv0;
+    if (sep) {
+        dir = _tcsdup(argv0);
+        dir[sep + 1 - argv0] = '\0';
+        basename = sep + 1;
+    }
+#ifdef _WIN32
+    TCHAR module_path[8192];
+    GetModuleFileName(NULL, module_path, sizeof(module_path)/sizeof(module_path[0]));
+    TCHAR *sep2 = _tcsrchr(module_path, '\\');
+    if (sep2) {
+        sep2[1] = '\0';
+        dir = _tcsdup(module_path);
+    }
+#else
+    if (!sep) {
+        // Invoked through $PATH; find our own directory the same way, to
+        // avoid picking up other tools that appear earlier in $PATH.
+        char *path = find_in_path(argv0);
+        char *sep2 = path ? strrchr(path, '/') : NULL;
+        if (sep2) {
+            sep2[1] = '\0';
+            dir = path;
+        }
+    }
+#endif
+    TCHAR *copy = _tcsdup(basename);
+    TCHAR *period = _tcschr(copy, '.');
+    if (period)
+        *period = '\0';
+    TCHAR *dash = _tcsrchr(copy, '-');
+    const TCHAR *target = copy;
+    const TCHAR *exe = copy;
+    if (dash) {
+        *dash = '\0';
+        exe = dash + 1;
+    } else {
+        target = _T(DEFAULT_TARGET);
+    }
+#ifndef _WIN32
+    trace_wrapper = exe;
+    trace_target = target;
+    trace_self = argv0;
+#endif
+    *dir_ptr = dir;
+    *basename_ptr = copy;
+    *target_ptr = target;
+    *exe_ptr = exe;
+}
+
+static inline TCHAR *get_arch(const TCHAR *target) {
+    TCHAR *arch = _tcsdup(target);
+    TCHAR *dash = _tcschr(arch, '-');
+    if (dash)
+        *dash = '\0';
+    return arch;
+}
+
+// Run the final tool, propagating its return code.
+static inline int run_final(const TCHAR **argv) {
+#ifdef _WIN32
+    int ret = _tspawnvp(_P_WAIT, argv[0], argv);
+    if (ret == -1) {
+        _tperror(argv[0]);
+        return 1;
+    }
+    return ret;
+#else
+    // On unix, exec() runs the target executable within this same process,
+    // making the return code propagate implicitly.
+    // Windows doesn't have such mechanisms, and the exec() family of functions
+    // makes the calling process exit immediately and always returning
+    // a zero return. This doesn't work for our case where we need the
+    // return code propagated.
+    if (trace_dir()) {
+        // Stay around to trace the tool.
+        pid_t pid = spawn_process(argv[0], argv, NULL);
+        if (pid < 0) {
+            perror(argv[0]);
+            return 1;
+        }
+        int status = wait_traced(pid);
+        if (status != -1 && WIFSIGNALED(status)) {
+            signal(WTERMSIG(status), SIG_DFL);
+            raise(WTERMSIG(status));
+        }
+        return status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    }
+    _texecvp(argv[0], EXECVP_CAST argv);
+
+    _tperror(argv[0]);
+    return 1;
+#endif
+}
+
+// Run a tool with its stdout captured, returning its exit code or -1.
+static inline int capture_stdout(const TCHAR **argv, struct buf *out) {
+#ifdef _WIN32
+    int len = 1;
+    for (int i = 0; argv[i]; i++)
+        len += _tcslen(argv[i]) + 1;
+    TCHAR *cmdline = malloc(len * sizeof(*cmdline));
+    int pos = 0;
+    // On Windows, the arguments are already quoted and escaped properly.
+    for (int i = 0; argv[i]; i++) {
+        _tcscpy(&cmdline[pos], argv[i]);
+        pos += _tcslen(argv[i]);
+        cmdline[pos++] = ' ';
+    }
+    if (pos > 0)
+        pos--;
+    cmdline[pos] = '\0';
+
+    STARTUPINFO si = { 0 };
+    PROCESS_INFORMATION pi = { 0 };
+    HANDLE pipe_read = NULL, pipe_write = NULL;
+    SECURITY_ATTRIBUTES sa = { 0 };
+    sa.nLength = sizeof(sa);
+    sa.bInheritHandle = TRUE;
+    CreatePipe(&pipe_read, &pipe_write, &sa, 0);
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = pipe_write;
+    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+    if (!CreateProcess(NULL, cmdline, NULL, NULL, /* bInheritHandles */ TRUE,
+                       0, NULL, NULL, &si, &pi)) {
+        _ftprintf(stderr, _T("Unable to execute: "TS"\n"), cmdline);
+        CloseHandle(pipe_read);
+        CloseHandle(pipe_write);
+        free(cmdline);
+        return -1;
+    }
+
+    CloseHandle(pipe_write);
+    char block[8192];
+    DWORD n;
+    while (ReadFile(pipe_read, block, sizeof(block), &n, NULL) && n > 0)
+        buf_append(out, block, n);
+    CloseHandle(pipe_read);
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    DWORD exit_code = 1;
+    GetExitCodeProcess(pi.hProcess, &exit_code);
+
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    free(cmdline);
+    return exit_code;
+#else
+    int fd;
+    pid_t pid = spawn_piped(argv, 1, -1, &fd);
+    if (pid < 0)
+        return -1;
+    read_all(fd, out);
+    return wait_child(pid);
+#endif
+}
+
+
+// Response files, with the same GNU style quoting rules as clang uses:
+// Whitespace separates arguments, a backslash escapes the next character,
+// and single or double quotes group characters. Quotes alone don't
+// produce an empty argument.
+//
+// Tokenize the file contents in place (the output never is longer than
+// the input), returning the number of arguments stored in tokens.
+static inline int tokenize_response_file(char *data, size_t len, char **tokens) {
+    int n = 0;
+    char *out = data, *start = NULL;
+    size_t i = 0;
+    while (i < len) {
+        char c = data[i];
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+            c == '\v' || c == '\f') {
+            if (start && start != out) {
+                *out++ = '\0';
+                tokens[n++] = start;
+            }
+            start = NULL;
+            i++;
+            continue;
+        }
+        if (!start)
+            start = out;
+        if (c == '\\' && i + 1 < len) {
+            *out++ = data[i + 1];
+            i += 2;
+        } else if (c == '"' || c == '\'') {
+            for (i++; i < len && data[i] != c; i++) {
+                if (data[i] == '\\' && i + 1 < len)
+                    i++;
+                *out++ = data[i];
+            }
+            i++;
+        } else {
+            *out++ = c;
+            i++;
+        }
+    }
+    if (start && start != out) {
+        *out = '\0';
+        tokens[n++] = start;
+    }
+    return n;
+}
+
+#ifdef _UNICODE
+static inline TCHAR *utf8_to_tchar(const char *str) {
+    int len = MultiByteToWideChar(CP_UTF8, 0, str, -1, NULL, 0);
+    TCHAR *out = malloc(len * sizeof(*out));
+    MultiByteToWideChar(CP_UTF8, 0, str, -1, out, len);
+    return out;
+}
+
+static inline char *tchar_to_utf8(const TCHAR *str) {
+    int len = WideCharToMultiByte(CP_UTF8, 0, str, -1, NULL, 0, NULL, NULL);
+    char *out = malloc(len);
+    WideCharToMultiByte(CP_UTF8, 0, str, -1, out, len, NULL, NULL);
+    return out;
+}
+#endif
+
+// Replace @file arguments with the arguments read from the files,
+// recursively, so that the wrappers can inspect them. Files that can't
+// be read are left as they are, like clang does.
+static inline void expand_response_files(int *argc_ptr, TCHAR ***argv_ptr) {
+    int argc = *argc_ptr;
+    TCHAR **argv = *argv_ptr;
+    int allocated = 0, expansions = 0;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '@' || expansions >= 64)
+            continue;
+        // Read the whole file with a single read and tokenize it in place;
+        // the tokens are kept for the lifetime of the process.
+        FILE *f = _tfopen(argv[i] + 1, _T("rb"));
+        if (!f)
+            continue;
+        long len = -1;
+        if (!fseek(f, 0, SEEK_END))
+            len = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        char *data = len >= 0 ? malloc(len + 1) : NULL;
+        if (!data || fread(data, 1, len, f) != (size_t) len) {
+            free(data);
+            fclose(f);
+            continue;
+        }
+        fclose(f);
+        data[len] = '\0';
+        if (len >= 2 && ((unsigned char) data[0] == 0xff ||
+                         (unsigned char) data[0] == 0xfe)) {
+            // UTF-16; leave it for clang to handle.
+            free(data);
+            continue;
+        }
+        char *text = data;
+        if (len >= 3 && !memcmp(data, "\xef\xbb\xbf", 3)) {
+            text += 3;
+            len -= 3;
+        }
+        // Each token needs at least one char plus a separator.
+        char **tokens = malloc((len / 2 + 1) * sizeof(*tokens));
+        int n = tokenize_response_file(text, len, tokens);
+
+        TCHAR **new_argv = malloc((argc + n) * sizeof(*new_argv));
+        memcpy(new_argv, argv, i * sizeof(*argv));
+        for (int j = 0; j < n; j++) {
+#ifdef _UNICODE
+            new_argv[i + j] = utf8_to_tchar(tokens[j]);
+#else
+            new_argv[i + j] = tokens[j];
+#endif
+        }
+        memcpy(&new_argv[i + n], &argv[i + 1],
+               (argc - i - 1) * sizeof(*argv));
+        argc += n - 1;
+        new_argv[argc] = NULL;
+        free(tokens);
+        if (allocated)
+            free(argv);
+        argv = new_argv;
+        allocated = 1;
+        expansions++;
+        // Revisit the same position, for nested response files.
+        i--;
+    }
+    *argc_ptr = argc;
+    *argv_ptr = argv;
+}
+
+#ifdef _WIN32
+// Undo escape(), returning the plain argument.
+static inline TCHAR *unescape(const TCHAR *str) {
+    size_t len = _tcslen(str);
+    TCHAR *out = malloc((len + 1) * sizeof(*out));
+    TCHAR *ptr = out;
+    if (len >= 2 && str[0] == '"' && str[len - 1] == '"') {
+        str++;
+        len -= 2;
+    }
+    for (size_t i = 0; i < len; ) {
+        size_t backslashes = 0;
+        while (i < len && str[i] == '\\') {
+            backslashes++;
+            i++;
+        }
+        if (i < len && str[i] == '"') {
+            // 2n+1 backslashes and a quote: n backslashes and a quote.
+            for (size_t j = 0; j < backslashes / 2; j++)
+                *ptr++ = '\\';
+            *ptr++ = str[i++];
+        } else if (i == len) {
+            // Final backslashes were doubled.
+            for (size_t j = 0; j < backslashes / 2; j++)
+                *ptr++ = '\\';
+        } else {
+            for (size_t j = 0; j < backslashes; j++)
+                *ptr++ = '\\';
+            *ptr++ = str[i++];
+        }
+    }
+    *ptr = '\0';
+    return out;
+}
+#endif
+
+// The command line length above which clang is passed its arguments in a
+// response file instead. Windows limits the command line to 32767 chars;
+// elsewhere, stay well below ARG_MAX. LLVM_MINGW_RSP_THRESHOLD overrides
+// the limit, e.g. for testing.
+static inline size_t response_file_threshold(void) {
+    const char *env = getenv("LLVM_MINGW_RSP_THRESHOLD");
+    if (env && *env)
+        return strtoull(env, NULL, 10);
+#ifdef _WIN32
+    return 30000;
+#else
+    long arg_max = sysconf(_SC_ARG_MAX);
+    return arg_max > 0 ? arg_max / 2 : 65536;
+#endif
+}
+
+// Create an empty temporary file, returning its name, or NULL. Only the
+// first three characters of prefix are used on Windows.
+static inline TCHAR *create_temp_file(const TCHAR *prefix) {
+#ifdef _WIN32
+    TCHAR tmpdir[MAX_PATH], path[MAX_PATH];
+    if (!GetTempPath(MAX_PATH, tmpdir) ||
+        !GetTempFileName(tmpdir, prefix, 0, path))
+        return NULL;
+    return _tcsdup(path);
+#else
+    const char *tmpdir = getenv("TMPDIR");
+    if (!tmpdir || !*tmpdir)
+        tmpdir = "/tmp";
+    char *path = malloc(strlen(tmpdir) + strlen(prefix) + 30);
+    sprintf(path, "%s/llvm-mingw-%s-XXXXXX", tmpdir, prefix);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        free(path);
+        return NULL;
+    }
+    close(fd);
+    return path;
+#endif
+}
+
+// If the command line for argv is too long, write all arguments but the
+// first keep ones to a response file, and return a new argv that refers
+// to it.
+// Returns NULL if no response file is needed (or possible). The caller
+// should remove the file at *rsp_path when done.
+static inline const TCHAR **write_response_file(const TCHAR **argv, int keep,
+                                         TCHAR **rsp_path) {
+    size_t len = 0;
+    for (int i = 0; argv[i]; i++) {
+        // The GNU quoting can't express empty arguments.
+        if (!argv[i][0] || !_tcscmp(argv[i], _T("\"\"")))
+            return NULL;
+        len += _tcslen(argv[i]) + 1;
+    }
+    if (len <= response_file_threshold())
+        return NULL;
+
+    struct buf b = { 0 };
+    for (int i = keep; argv[i]; i++) {
+#ifdef _WIN32
+        TCHAR *arg = unescape(argv[i]);
+#ifdef _UNICODE
+        int n = WideCharToMultiByte(CP_UTF8, 0, arg, -1, NULL, 0, NULL, NULL);
+        char *str = malloc(n);
+        WideCharToMultiByte(CP_UTF8, 0, arg, -1, str, n, NULL, NULL);
+        free(arg);
+#else
+        char *str = arg;
+#endif
+#else
+        const char *str = argv[i];
+#endif
+        for (const char *ptr = str; *ptr; ptr++) {
+            if (strchr(" \t\n\r\v\f\\'\"", *ptr))
+                buf_append(&b, "\\", 1);
+            buf_append(&b, ptr, 1);
+        }
+        buf_append(&b, "\n", 1);
+#ifdef _WIN32
+        free(str);
+#endif
+    }
+
+    TCHAR *path = create_temp_file(_T("rsp"));
+    if (!path) {
+        free(b.data);
+        return NULL;
+    }
+    FILE *f = _tfopen(path, _T("wb"));
+    int ok = f && fwrite(b.data, 1, b.len, f) == b.len;
+    if (f && fclose(f))
+        ok = 0;
+    free(b.data);
+    if (!ok) {
+        _tunlink(path);
+        free(path);
+        return NULL;
+    }
+
+    const TCHAR **rsp_argv = malloc((keep + 2) * sizeof(*rsp_argv));
+    memcpy(rsp_argv, argv, keep * sizeof(*argv));
+    TCHAR *at = concat(_T("@"), path);
+    rsp_argv[keep] = escape(at);
+    rsp_argv[keep + 1] = NULL;
+    free(at);
+    *rsp_path = path;
+    return rsp_argv;
+}
+
+// Spawn clang and wait for it, passing the arguments in a response file
+// if necessary. Returns the exit code, or -1 if it couldn't be run.
+static inline int spawn_clang(const TCHAR **argv) {
+    TCHAR *rsp_path;
+    const TCHAR **rsp_argv = write_response_file(argv, 1, &rsp_path);
+    if (!rsp_argv)
+        return _tspawnvp(_P_WAIT, argv[0], argv);
+    int ret = _tspawnvp(_P_WAIT, rsp_argv[0], rsp_argv);
+    _tunlink(rsp_path);
+    return ret;
+}
+
+// Like run_final, for clang, using a response file if necessary. The
+// first keep arguments (e.g. "ccache clang") stay on the command line.
+static inline int run_final_clang(const TCHAR **argv, int keep) {
+    TCHAR *rsp_path;
+    const TCHAR **rsp_argv = write_response_file(argv, keep, &rsp_path);
+    if (!rsp_argv)
+        return run_final(argv);
+    int ret = _tspawnvp(_P_WAIT, rsp_argv[0], rsp_argv);
+    if (ret == -1) {
+        _tperror(argv[0]);
+        ret = 1;
+    }
+    _tunlink(rsp_path);
+    return ret;
+}
+
+
+// Optimization profiles, selected by LLVM_MINGW_PROFILE=<name>, from the
+// file <target>-profiles.cfg next to the executables. The file consists
+// of sections like
+//
+//     [release-size]
+//     cflags = -Os -ffunction-sections -fdata-sections
+//     ldflags = --gc-sections --icf=all
+//
+// where cflags are added before the user's options to compiles, and
+// ldflags are added to links (with -Wl, when linking through clang).
+// Values are split like response files; lines starting with # are
+// comments.
+struct profile {
+    const TCHAR **cflags, **ldflags;
+    int nb_cflags, nb_ldflags;
+};
+
+static inline void profile_add_flags(const TCHAR ***flags, int *nb_flags,
+                              char *value) {
+    char **tokens = malloc((strlen(value) / 2 + 1) * sizeof(*tokens));
+    int n = tokenize_response_file(value, strlen(value), tokens);
+    *flags = realloc(*flags, (*nb_flags + n) * sizeof(**flags));
+    for (int i = 0; i < n; i++) {
+#ifdef _UNICODE
+        (*flags)[(*nb_flags)++] = utf8_to_tchar(tokens[i]);
+#else
+        (*flags)[(*nb_flags)++] = tokens[i];
+#endif
+    }
+    free(tokens);
+}
+
+// Returns the selected profile, or an empty one if none is selected. The
+// file is only read (with a single read) the first time. Returns NULL,
+// after printing an error, if the selected profile doesn't exist.
+static inline const struct profile *get_profile(const TCHAR *dir,
+                                         const TCHAR *target) {
+    static struct profile profile;
+    static int loaded;
+    if (loaded)
+        return &profile;
+    loaded = 1;
+    const char *name = getenv("LLVM_MINGW_PROFILE");
+    if (!name || !*name)
+        return &profile;
+
+    TCHAR *prefix = concat(dir, target);
+    TCHAR *path = concat(prefix, _T("-profiles.cfg"));
+    free(prefix);
+    FILE *f = _tfopen(path, _T("rb"));
+    long len = -1;
+    char *data = NULL;
+    if (f) {
+        if (!fseek(f, 0, SEEK_END))
+            len = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        data = len >= 0 ? malloc(len + 1) : NULL;
+        if (data && fread(data, 1, len, f) != (size_t) len) {
+            free(data);
+            data = NULL;
+        }
+        fclose(f);
+    }
+    if (!data) {
+        _ftprintf(stderr, _T(TS": Unable to read profiles for "
+                             "LLVM_MINGW_PROFILE\n"), path);
+        free(path);
+        return NULL;
+    }
+    data[len] = '\0';
+
+    int in_section = 0, found = 0;
+    char *line = data;
+    while (line) {
+        char *end = strchr(line, '\n');
+        if (end)
+            *end++ = '\0';
+        while (*line == ' ' || *line == '\t')
+            line++;
+        size_t line_len = strlen(line);
+        while (line_len > 0 && strchr(" \t\r", line[line_len - 1]))
+            line[--line_len] = '\0';
+        char *eq = strchr(line, '=');
+        if (line[0] == '[' && line_len > 1 && line[line_len - 1] == ']') {
+            line[line_len - 1] = '\0';
+            in_section = !strcmp(line + 1, name);
+            found |= in_section;
+        } else if (in_section && line[0] != '#' && eq) {
+            char *key_end = eq;
+            while (key_end > line && strchr(" \t", key_end[-1]))
+                key_end--;
+            *key_end = '\0';
+            if (!strcmp(line, "cflags"))
+                profile_add_flags(&profile.cflags, &profile.nb_cflags, eq + 1);
+            else if (!strcmp(line, "ldflags"))
+                profile_add_flags(&profile.ldflags, &profile.nb_ldflags,
+                                  eq + 1);
+        }
+        line = end;
+    }
+    if (!found) {
+        _ftprintf(stderr, _T(TS": No profile named "), path);
+        fprintf(stderr, "\"%s\"\n", name);
+        free(path);
+        return NULL;
+    }
+    free(path);
+    return &profile;
+}
+
+// With LLVM_MINGW_GHASH=1, compiles emit global type hashes along with
+// CodeView debug info (-gcodeview-ghash), and links that write a PDB have
+// lld merge the types by those hashes (-debug:ghash), which it can do in
+// parallel, instead of hashing every type record serially.
+static inline int use_ghash(void) {
+    const char *ghash = getenv("LLVM_MINGW_GHASH");
+    return ghash && *ghash && strcmp(ghash, "0");
+}
+
+// Check if lld accepts an -Xlink=<option>; versions of lld older than
+// the -Xlink option itself (like the one pinned in build-llvm.sh) reject
+// it, and the link would fail. This runs "ld.lld -m i386pep -Xlink=...
+// --version", which isn't done on Windows, where we assume it does.
+static inline int lld_supports_xlink(const TCHAR *dir, const TCHAR *opt) {
+#ifdef _WIN32
+    (void) dir;
+    (void) opt;
+    return 1;
+#else
+    char *lld = concat(dir, "ld.lld");
+    const char *argv[] = { lld, "-m", "i386pep", opt, "--version", NULL };
+    const int fds[3] = { -2, -2, -2 };
+    pid_t pid = spawn_process(lld, argv, fds);
+    int ret = pid < 0 ? -1 : wait_child(pid);
+    free(lld);
+    return ret == 0;
+#endif
+}
+
+// For links that write a PDB: Check if -debug:ghash should be passed to
+// lld, which needs use_ghash() and an lld with -Xlink. If lld lacks it,
+// warn and link without it.
+static inline int use_ghash_link(const TCHAR *dir) {
+    if (!use_ghash())
+        return 0;
+    if (lld_supports_xlink(dir, _T("-Xlink=-debug:ghash")))
+        return 1;
+    fprintf(stderr, "warning: ld.lld doesn't support -Xlink, linking "
+                    "without -debug:ghash\n");
+    return 0;
+}
+
+// Check if a linker option asks for a PDB; -pdb <file>, --pdb=<file> etc.
+static inline int is_pdb_option(const TCHAR *arg) {
+    if (arg[0] != '-')
+        return 0;
+    arg += arg[1] == '-' ? 2 : 1;
+    return !_tcsncmp(arg, _T("pdb"), 3) && (arg[3] == '\0' || arg[3] == '=');
+}
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2018 Martin Storsjo
+ *
+ * This file is part of llvm-mingw.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "native-wrapper.h"
+
+// Print the lines of llvm-readobj output that libtool looks for, in the
+// form GNU objdump -f prints them.
+static void print_file_formats(char *text) {
+    char *file = NULL;
+    char *line = text;
+    while (line && *line) {
+        char *end = strchr(line, '\n');
+        if (end)
+            *end++ = '\0';
+        while (*line == ' ' || *line == '\t')
+            line++;
+        char *value = strchr(line, ' ');
+        if (value) {
+            // Only the first word after the label is used.
+            value += strspn(value, " \t");
+            value[strcspn(value, " \t\r")] = '\0';
+        }
+        if (!strncmp(line, "File:", 5)) {
+            file = value;
+        } else if (!strncmp(line, "Format:", 7)) {
+            const char *format = value ? value : "";
+            if (!strcmp(format, "COFF-i386"))
+                format = "pe-i386";
+            else if (!strcmp(format, "COFF-x86-64"))
+                format = "pe-x86-64";
+            else if (!strncmp(format, "COFF-ARM", 8))
+                // This is wrong; modern COFF armv7 isn't pe-arm-wince, and
+                // arm64 definitely isn't, but libtool wants to see this
+                // string (or some of the others) in order to accept it.
+                format = "pe-arm-wince";
+            printf("%s: file format %s\n", file ? file : "", format);
+        }
+        line = end;
+    }
+}
+
+// Fast path for objdump -f: libtool runs it on every library it considers
+// linking, so instead of running llvm-readobj, the COFF and archive
+// headers are read directly from a mapping of the file, and the same
+// lines are printed as for the llvm-readobj output above. Anything but
+// COFF objects, PE images and archives of those (and of short import
+// members) is left to llvm-readobj, as is everything with
+// LLVM_MINGW_BUILTIN_OBJDUMP=0.
+
+static const unsigned char *map_file(const TCHAR *path, size_t *size) {
+#ifdef _WIN32
+    HANDLE file = CreateFile(path, GENERIC_READ,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE |
+                             FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    const void *view = NULL;
+    LARGE_INTEGER file_size;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 &&
+        (unsigned long long) file_size.QuadPart <= SIZE_MAX) {
+        HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0,
+                                           NULL);
+        if (mapping) {
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        *size = file_size.QuadPart;
+    }
+    CloseHandle(file);
+    return view;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (unsigned long long) st.st_size <= SIZE_MAX) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        *size = st.st_size;
+    }
+    close(fd);
+    return data == MAP_FAILED ? NULL : data;
+#endif
+}
+
+static unsigned read16(const unsigned char *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t read32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static const char *machine_format(unsigned machine) {
+    switch (machine) {
+    case 0x14c:  return "pe-i386";
+    case 0x8664: return "pe-x86-64";
+    case 0x1c4:  // ARMNT
+    case 0xaa64: return "pe-arm-wince";
+    default:     return NULL;
+    }
+}
+
+// The format of a file or archive member, like print_file_formats maps
+// it, or NULL if llvm-readobj has to tell.
+static const char *object_format(const unsigned char *data, size_t size) {
+    if (size >= 20 && machine_format(read16(data)))
+        return machine_format(read16(data));
+    // Short import members; big object files have a nonzero version.
+    if (size >= 20 && read16(data) == 0 && read16(data + 2) == 0xffff &&
+        read16(data + 4) == 0)
+        return "COFF-import-file";
+    if (size >= 0x40 && data[0] == 'M' && data[1] == 'Z') {
+        uint32_t offset = read32(data + 0x3c);
+        if (offset <= size - 24 && !memcmp(data + offset, "PE\0\0", 4))
+            return machine_format(read16(data + offset + 4));
+    }
+    return NULL;
+}
+
+static int parse_decimal(const unsigned char *str, int len, size_t *value) {
+    int digits = 0;
+    *value = 0;
+    for (int i = 0; i < len && str[i] != ' '; i++, digits++) {
+        if (str[i] < '0' || str[i] > '9' || *value > SIZE_MAX / 10 - 1)
+            return 0;
+        *value = *value * 10 + str[i] - '0';
+    }
+    return digits > 0;
+}
+
+// Append the lines for the members of an archive to out. Returns 0 if
+// they all are COFF objects or short import members.
+static int archive_formats(const char *path, const unsigned char *data,
+                           size_t size, struct buf *out) {
+    const unsigned char *names = NULL;
+    size_t names_size = 0;
+    size_t pos = 8;
+    while (pos < size) {
+        const unsigned char *hdr = data + pos;
+        size_t member_size;
+        if (size - pos < 60 || memcmp(hdr + 58, "`\n", 2) ||
+            !parse_decimal(hdr + 48, 10, &member_size) ||
+            member_size > size - pos - 60)
+            return -1;
+        const unsigned char *member = hdr + 60;
+        pos += 60 + member_size;
+        if (pos < size && (member_size & 1))
+            pos++;
+
+        const char *name;
+        size_t name_len;
+        size_t offset;
+        if (!memcmp(hdr, "/ ", 2) || !memcmp(hdr, "/SYM64/ ", 8)) {
+            // Symbol tables.
+            continue;
+        } else if (!memcmp(hdr, "// ", 3)) {
+            names = member;
+            names_size = member_size;
+            continue;
+        } else if (hdr[0] == '/' && parse_decimal(hdr + 1, 15, &offset)) {
+            // A long name, ending with "/\n" in GNU archives and with a
+            // null in COFF ones.
+            if (!names || offset >= names_size)
+                return -1;
+            name = (const char *) names + offset;
+            name_len = 0;
+            while (offset + name_len < names_size &&
+                   name[name_len] != '\n' && name[name_len] != '\0')
+                name_len++;
+            if (name_len > 0 && name[name_len - 1] == '/')
+                name_len--;
+        } else if (!memcmp(hdr, "#1/", 3) && parse_decimal(hdr + 3, 13,
+                                                           &name_len)) {
+            // BSD archives, with the name before the data.
+            if (name_len > member_size)
+                return -1;
+            name = (const char *) member;
+            member += name_len;
+            member_size -= name_len;
+            while (name_len > 0 && name[name_len - 1] == '\0')
+                name_len--;
+            if (name_len >= 9 && !memcmp(name, "__.SYMDEF", 9))
+                continue;
+        } else {
+            name = (const char *) hdr;
+            name_len = 0;
+            while (name_len < 16 && name[name_len] != '/')
+                name_len++;
+            while (name_len > 0 && name[name_len - 1] == ' ')
+                name_len--;
+        }
+
+        const char *format = object_format(member, member_size);
+        if (!format)
+            return -1;
+        // llvm-readobj names import members without the archive.
+        int import = !strcmp(format, "COFF-import-file");
+        if (!import) {
+            buf_append(out, path, strlen(path));
+            buf_append(out, "(", 1);
+        }
+        buf_append(out, name, name_len);
+        if (!import)
+            buf_append(out, ")", 1);
+        buf_append(out, ": file format ", 14);
+        buf_append(out, format, strlen(format));
+        buf_append(out, "\n", 1);
+    }
+    return 0;
+}
+
+// Print the file formats for objdump -f without llvm-readobj. Returns -1
+// if it has to be run after all.
+static int print_file_formats_builtin(const TCHAR *file) {
+    const TCHAR *env = _tgetenv(_T("LLVM_MINGW_BUILTIN_OBJDUMP"));
+    if (env && !_tcscmp(env, _T("0")))
+        return -1;
+    size_t size = 0;
+    const unsigned char *data = map_file(file, &size);
+    if (!data)
+        return -1;
+#ifdef _UNICODE
+    // llvm-readobj prints the names in UTF-8.
+    int n = WideCharToMultiByte(CP_UTF8, 0, file, -1, NULL, 0, NULL, NULL);
+    char *path = malloc(n);
+    WideCharToMultiByte(CP_UTF8, 0, file, -1, path, n, NULL, NULL);
+#else
+    const char *path = file;
+#endif
+    struct buf out = { 0 };
+    if (size >= 8 && !memcmp(data, "!<arch>\n", 8)) {
+        if (archive_formats(path, data, size, &out))
+            return -1;
+    } else {
+        const char *format = object_format(data, size);
+        if (!format)
+            return -1;
+        buf_append(&out, path, strlen(path));
+        buf_append(&out, ": file format ", 14);
+        buf_append(&out, format, strlen(format));
+        buf_append(&out, "\n", 1);
+    }
+    if (out.len)
+        fwrite(out.data, 1, out.len, stdout);
+    return 0;
+}
+
+int _tmain(int argc, TCHAR* argv[]) {
+    const TCHAR *dir;
+    const TCHAR *basename;
+    const TCHAR *target;
+    const TCHAR *exe;
+    split_argv(argv[0], &dir, &basename, &target, &exe);
+
+    int max_arg = argc + 20;
+    const TCHAR **exec_argv = malloc(max_arg * sizeof(*exec_argv));
+    int arg = 0;
+
+    if (argc > 2 && !_tcscmp(argv[1], _T("-f"))) {
+        // libtool can try to run objdump -f and wants to see certain strings in
+        // the output, to accept it being a windows (import) library
+        if (print_file_formats_builtin(argv[2]) == 0)
+            return 0;
+        exec_argv[arg++] = concat(dir, _T("llvm-readobj"));
+        exec_argv[arg++] = escape(argv[2]);
+        exec_argv[arg] = NULL;
+        struct buf out = { 0 };
+        int ret = capture_stdout(exec_argv, &out);
+        if (out.data)
+            print_file_formats(out.data);
+        return ret < 0 ? 1 : ret;
+    }
+
+    exec_argv[arg++] = concat(dir, _T("llvm-objdump"));
+    for (int i = 1; i < argc; i++)
+        exec_argv[arg++] = escape(argv[i]);
+
+    exec_argv[arg] = NULL;
+    if (arg > max_arg) {
+        fprintf(stderr, "Too many options added\n");
+        abort();
+    }
+
+    return run_final(exec_argv);
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2018 Martin Storsjo
+ *
+ * This file is part of llvm-mingw.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Runtime for function order tracing (liborderfile-rt.a, built by
+// build-orderfile-rt.sh), linked into executables and DLLs by the clang
+// wrapper when built with LLVM_MINGW_ORDER_INSTRUMENT=1.
+// The code is compiled with -finstrument-functions-after-inlining; we
+// record the address of each function the first time it is called, and
+// write the list of RVAs to <module>.order-trace (or to
+// $LLVM_MINGW_ORDER_TRACE_DIR/<module name>.order-trace) on exit.
+// make-order-file.py turns this into a symbol ordering file for the
+// linker.
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_INSTRUMENT __attribute__((no_instrument_function))
+
+#define TABLE_SIZE (1 << 18)
+
+static void *volatile seen[TABLE_SIZE];
+static unsigned int order[TABLE_SIZE];
+static volatile LONG nb_order;
+static volatile LONG initialized;
+static char *module_base;
+
+static NO_INSTRUMENT void write_trace(void) {
+    char path[MAX_PATH + 32];
+    char module[MAX_PATH];
+    if (!GetModuleFileNameA((HMODULE) module_base, module, sizeof(module)))
+        return;
+    const char *dir = getenv("LLVM_MINGW_ORDER_TRACE_DIR");
+    if (dir && *dir) {
+        const char *name = strrchr(module, '\\');
+        snprintf(path, sizeof(path), "%s\\%s.order-trace", dir,
+                 name ? name + 1 : module);
+    } else {
+        snprintf(path, sizeof(path), "%s.order-trace", module);
+    }
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return;
+    LONG n = nb_order < TABLE_SIZE ? nb_order : TABLE_SIZE;
+    for (LONG i = 0; i < n; i++)
+        fprintf(f, "0x%x\n", order[i]);
+    fclose(f);
+}
+
+NO_INSTRUMENT void __cyg_profile_func_enter(void *fn, void *call_site) {
+    (void) call_site;
+    if (!initialized) {
+        // Find the module containing this runtime, which is the one whose
+        // functions call us.
+        HMODULE module;
+        if (InterlockedCompareExchange(&initialized, 1, 0) == 0) {
+            GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                               GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                               (LPCSTR) &write_trace, &module);
+            module_base = (char *) module;
+            atexit(write_trace);
+            initialized = 2;
+        }
+        while (initialized != 2)
+            ;
+    }
+    // Insert the address into an open addressing hash table; only the
+    // thread that fills in the slot appends it to the order.
+    unsigned int hash = (unsigned int) (((UINT_PTR) fn >> 4) * 2654435761u);
+    for (unsigned int i = 0; i < TABLE_SIZE; i++) {
+        void *volatile *slot = &seen[(hash + i) & (TABLE_SIZE - 1)];
+        void *prev = *slot;
+        if (prev == fn)
+            return;
+        if (!prev) {
+            prev = InterlockedCompareExchangePointer(
+                (PVOID volatile *) slot, fn, NULL);
+            if (prev == NULL) {
+                LONG idx = InterlockedIncrement(&nb_order) - 1;
+                if (idx < TABLE_SIZE)
+                    order[idx] = (unsigned int) ((char *) fn - module_base);
+                return;
+            }
+            if (prev == fn)
+                return;
+        }
+    }
+}
+
+NO_INSTRUMENT void __cyg_profile_func_exit(void *fn, void *call_site) {
+    (void) fn;
+    (void) call_site;
+}
@@ -27,109 +27,7 @@
  * For more information, please refer to <http://unlicense.org/>
  */
 
-#ifdef UNICODE
-#define _UNICODE
-#endif
-
-#ifndef DEFAULT_TARGET
-#define DEFAULT_TARGET "x86_64-w64-mingw32"
-#endif
-
-#include <stdio.h>
-#include <string.h>
-#include <stdlib.h>
-#include <stdarg.h>
-
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include <tchar.h>
-#include <windows.h>
-#include <process.h>
-#else
-#include <unistd.h>
-typedef char TCHAR;
-#define _T(x) x
-#define _tcsrchr strrchr
-#define _tcschr strchr
-#define _tcsdup strdup
-#define _tcscpy strcpy
-#define _tcslen strlen
-#define _tcscmp strcmp
-#define _tcsncmp strncmp
-#define _tperror perror
-#define _texecvp execvp
-#define _tmain main
-#define _tspawnvp _spawnvp
-#define _ftprintf fprintf
-#define _vftprintf vfprintf
-#define _tunlink unlink
-
-#include <sys/wait.h>
-#include <errno.h>
-
-#define _P_WAIT 0
-static int _spawnvp(int mode, const char *filename, const char * const *argv) {
-    pid_t pid;
-    if (!(pid = fork())) {
-        execvp(filename, (char **) argv);
-        perror(filename);
-        exit(1);
-    }
-    int stat = 0;
-    if (waitpid(pid, &stat, 0) == -1)
-        return -1;
-    if (WIFEXITED(stat))
-        return WEXITSTATUS(stat);
-    errno = EIO;
-    return -1;
-}
-#endif
-
-#ifdef _UNICODE
-#define TS "%ls"
-#else
-#define TS "%s"
-#endif
-
-static TCHAR *escape(const TCHAR *str) {
-#ifdef _WIN32
-    TCHAR *out = malloc((_tcslen(str) * 2 + 3) * sizeof(*out));
-    TCHAR *ptr = out;
-    int i;
-    *ptr++ = '"';
-    for (i = 0; str[i]; i++) {
-        if (str[i] == '"') {
-            int j = i - 1;
-            // Before all double quotes, backslashes need to be escaped, but
-            // not elsewhere.
-            while (j >= 0 && str[j--] == '\\')
-                *ptr++ = '\\';
-            // Escape the next double quote.
-            *ptr++ = '\\';
-        }
-        *ptr++ = str[i];
-    }
-    // Any final backslashes, before the quote around the whole argument,
-    // need to be doubled.
-    int j = i - 1;
-    while (j >= 0 && str[j--] == '\\')
-        *ptr++ = '\\';
-    *ptr++ = '"';
-    *ptr++ = '\0';
-    return out;
-#else
-    return _tcsdup(str);
-#endif
-}
-
-static TCHAR *concat(const TCHAR *prefix, const TCHAR *suffix) {
-    int prefixlen = _tcslen(prefix);
-    int suffixlen = _tcslen(suffix);
-    TCHAR *buf = malloc((prefixlen + suffixlen + 1) * sizeof(*buf));
-    _tcscpy(buf, prefix);
-    _tcscpy(buf + prefixlen, suffix);
-    return buf;
-}
+#include "native-wrapper.h"
 
 // GNU binutils windres seem to require an extra level of escaping of
 // -D options to the preprocessor, which we need to undo here.
@@ -176,6 +74,11 @@ static void print_help(void) {
 "  -U, --undefine <arg[=val]> Undefine to pass to preprocessor.\n"
 "  -c, --codepage <arg>       Default codepage to use when reading an rc file (0x0-0xffff).\n"
 "      --use-temp-file        Use a temporary file for the preprocessing output.\n"
+"  -MD                        Write a dependency file, next to the output.\n"
+"  -MMD                       Like -MD, but leave out system headers.\n"
+"  -MF <file>                 Name of the dependency file.\n"
+"  -MT <target>               Target name in the dependency file.\n"
+"  -MP                        Add phony targets for the dependencies.\n"
 "  -v, --verbose              Enable verbose output.\n"
 "  -V, --version              Display version.\n"
 "  -h, --help                 Display this message and exit.\n"
@@ -204,6 +107,32 @@ static void error(const TCHAR *basename, const TCHAR *fmt, ...) {
     exit(1);
 }
 
+#ifndef _WIN32
+// Copy a file to an output that may not be seekable, like /dev/stdout.
+static int stream_file(const char *src, const char *dest) {
+    int in = open(src, O_RDONLY);
+    if (in < 0)
+        return 1;
+    int out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out < 0) {
+        close(in);
+        return 1;
+    }
+    char block[65536];
+    ssize_t n;
+    while ((n = read(in, block, sizeof(block))) > 0) {
+        if (write(out, block, n) != n) {
+            n = -1;
+            break;
+        }
+    }
+    close(in);
+    if (close(out) || n < 0)
+        return 1;
+    return 0;
+}
+#endif
+
 static void print_argv(const TCHAR **exec_argv) {
     while (*exec_argv) {
         _ftprintf(stderr, _T(TS" "), *exec_argv);
@@ -212,52 +141,848 @@ static void print_argv(const TCHAR **exec_argv) {
     _ftprintf(stderr, _T("\n"));
 }
 
-static TCHAR *_tcsrchrs(const TCHAR *str, TCHAR char1, TCHAR char2) {
-    TCHAR *ptr1 = _tcsrchr(str, char1);
-    TCHAR *ptr2 = _tcsrchr(str, char2);
-    if (!ptr1)
-        return ptr2;
-    if (!ptr2)
-        return ptr1;
-    if (ptr1 < ptr2)
-        return ptr2;
-    return ptr1;
+// Built-in .res to COFF conversion, producing the same object file as
+// llvm-cvtres, without spawning it. The resources are sorted into a tree
+// of types, names and languages, which is written to the .rsrc$01
+// section, followed by one relocation per resource, against a symbol
+// pointing at its data in .rsrc$02. Only the headers of the .res file are
+// kept in memory; the resource data is copied from the input in blocks
+// while writing the output, which therefore can be a pipe. Anything
+// unusual (like duplicate resources, which llvm-cvtres either reports or
+// filters) makes us fall back to llvm-cvtres. Setting
+// LLVM_MINGW_BUILTIN_CVTRES=0 disables this.
+
+struct res_id {
+    uint16_t *str; // NULL for a numeric ID
+    int len;
+    uint16_t id;
+};
+
+struct res_entry {
+    struct res_id type, name;
+    uint16_t lang;
+    long offset;
+    uint32_t size;
+};
+
+struct res_node {
+    struct res_id key;
+    int string_index, data_index;
+    struct res_node **children;
+    int nb_children, nb_string_children;
+};
+
+static void put16(unsigned char *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
 }
 
-int _tmain(int argc, TCHAR* argv[]) {
-    const TCHAR *argv0 = argv[0];
-    const TCHAR *sep = _tcsrchrs(argv0, '/', '\\');
-    TCHAR *dir = _tcsdup(_T(""));
-    const TCHAR *basename = argv0;
-    if (sep) {
-        dir = _tcsdup(argv0);
-        dir[sep + 1 - argv0] = '\0';
-        basename = sep + 1;
+static void put32(unsigned char *p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static int read_u16(FILE *f, long *pos, uint16_t *v) {
+    unsigned char b[2];
+    if (fread(b, 1, 2, f) != 2)
+        return -1;
+    *pos += 2;
+    *v = b[0] | (b[1] << 8);
+    return 0;
+}
+
+static int read_u32(FILE *f, long *pos, uint32_t *v) {
+    uint16_t lo, hi;
+    if (read_u16(f, pos, &lo) || read_u16(f, pos, &hi))
+        return -1;
+    *v = lo | ((uint32_t) hi << 16);
+    return 0;
+}
+
+// Read a type or name, which is either 0xffff and a numeric ID, or a
+// null terminated UTF-16 string. llvm-cvtres converts strings to UTF-8
+// internally, so we only take valid ones that don't start with a BOM.
+static int read_res_id(FILE *f, long *pos, struct res_id *id) {
+    uint16_t c;
+    memset(id, 0, sizeof(*id));
+    if (read_u16(f, pos, &c))
+        return -1;
+    if (c == 0xffff)
+        return read_u16(f, pos, &id->id);
+    int max = 16;
+    id->str = malloc(max * sizeof(*id->str));
+    while (c != 0) {
+        if (id->len == max) {
+            max *= 2;
+            id->str = realloc(id->str, max * sizeof(*id->str));
+        }
+        id->str[id->len++] = c;
+        if (id->len > 4096 || read_u16(f, pos, &c))
+            return -1;
     }
-#ifdef _WIN32
-    TCHAR module_path[8192];
-    GetModuleFileName(NULL, module_path, sizeof(module_path)/sizeof(module_path[0]));
-    TCHAR *sep2 = _tcsrchr(module_path, '\\');
-    if (sep2) {
-        sep2[1] = '\0';
-        dir = _tcsdup(module_path);
+    if (id->len > 0 && (id->str[0] == 0xfeff || id->str[0] == 0xfffe))
+        return -1;
+    for (int i = 0; i < id->len; i++) {
+        if (id->str[i] >= 0xd800 && id->str[i] < 0xdc00) {
+            if (i + 1 >= id->len || id->str[i + 1] < 0xdc00 ||
+                id->str[i + 1] >= 0xe000)
+                return -1;
+            i++;
+        } else if (id->str[i] >= 0xdc00 && id->str[i] < 0xe000) {
+            return -1;
+        }
     }
-#endif
-    basename = _tcsdup(basename);
-    TCHAR *period = _tcschr(basename, '.');
-    if (period)
-        *period = '\0';
-    TCHAR *dash = _tcsrchr(basename, '-');
-    const TCHAR *target = basename;
-    if (dash) {
-        *dash = '\0';
+    return 0;
+}
+
+static uint32_t next_code_point(const struct res_id *id, int *i) {
+    uint32_t c = id->str[(*i)++];
+    if (c >= 0xd800 && c < 0xdc00)
+        c = 0x10000 + ((c - 0xd800) << 10) + (id->str[(*i)++] - 0xdc00);
+    return c;
+}
+
+// Strings (in code point order) before IDs (in numeric order).
+static int compare_res_ids(const struct res_id *a, const struct res_id *b) {
+    if (!a->str || !b->str) {
+        if (a->str || b->str)
+            return a->str ? -1 : 1;
+        return a->id < b->id ? -1 : a->id > b->id;
+    }
+    int i = 0, j = 0;
+    while (i < a->len && j < b->len) {
+        uint32_t ca = next_code_point(a, &i), cb = next_code_point(b, &j);
+        if (ca != cb)
+            return ca < cb ? -1 : 1;
+    }
+    return (i < a->len) - (j < b->len);
+}
+
+static int compare_res_nodes(const void *a, const void *b) {
+    const struct res_node *na = *(struct res_node * const *) a;
+    const struct res_node *nb = *(struct res_node * const *) b;
+    return compare_res_ids(&na->key, &nb->key);
+}
+
+// Find or add the child with the given key. New string keys are added to
+// the string table, once for every node they appear in, like llvm-cvtres
+// does. Returns NULL for an existing child if data_index >= 0.
+static struct res_node *res_child(struct res_node *parent,
+                                  const struct res_id *key, int data_index,
+                                  const struct res_id **strings,
+                                  int *nb_strings, int *nb_nodes) {
+    for (int i = 0; i < parent->nb_children; i++)
+        if (!compare_res_ids(&parent->children[i]->key, key))
+            return data_index >= 0 ? NULL : parent->children[i];
+    struct res_node *node = calloc(1, sizeof(*node));
+    node->key = *key;
+    node->data_index = data_index;
+    node->string_index = -1;
+    if (key->str) {
+        node->string_index = *nb_strings;
+        strings[(*nb_strings)++] = &node->key;
+        parent->nb_string_children++;
+    }
+    parent->children = realloc(parent->children,
+                               (parent->nb_children + 1) *
+                                   sizeof(*parent->children));
+    parent->children[parent->nb_children++] = node;
+    (*nb_nodes)++;
+    return node;
+}
+
+static uint32_t res_tree_size(struct res_node *node) {
+    uint32_t size = node->nb_children * 8;
+    if (node->data_index >= 0)
+        return size + 16;
+    qsort(node->children, node->nb_children, sizeof(*node->children),
+          compare_res_nodes);
+    size += 16;
+    for (int i = 0; i < node->nb_children; i++)
+        size += res_tree_size(node->children[i]);
+    return size;
+}
+
+static uint32_t align_to(uint32_t value, uint32_t align) {
+    return (value + align - 1) / align * align;
+}
+
+// Returns 0 on success, 1 on failure (which has been reported), or -1 if
+// llvm-cvtres should be used instead.
+static int convert_res(const TCHAR *input, const TCHAR *output,
+                       const TCHAR *machine_name) {
+    const TCHAR *env = _tgetenv(_T("LLVM_MINGW_BUILTIN_CVTRES"));
+    if (env && !_tcscmp(env, _T("0")))
+        return -1;
+    uint16_t machine, reloc_type;
+    if (!_tcscmp(machine_name, _T("X86"))) {
+        machine = 0x14c;
+        reloc_type = 7; // IMAGE_REL_I386_DIR32NB
+    } else if (!_tcscmp(machine_name, _T("X64"))) {
+        machine = 0x8664;
+        reloc_type = 3; // IMAGE_REL_AMD64_ADDR32NB
+    } else if (!_tcscmp(machine_name, _T("ARM"))) {
+        machine = 0x1c4;
+        reloc_type = 2; // IMAGE_REL_ARM_ADDR32NB
+    } else if (!_tcscmp(machine_name, _T("ARM64"))) {
+        machine = 0xaa64;
+        reloc_type = 2; // IMAGE_REL_ARM64_ADDR32NB
     } else {
-        target = _T(DEFAULT_TARGET);
+        return -1;
+    }
+
+    FILE *in = _tcscmp(input, _T("-")) ? _tfopen(input, _T("rb")) : NULL;
+    if (!in)
+        return -1;
+    static const unsigned char magic[16] = {
+        0, 0, 0, 0, 0x20, 0, 0, 0, 0xff, 0xff, 0, 0, 0xff, 0xff, 0, 0
+    };
+    unsigned char head[32];
+    long file_size = -1;
+    if (!fseek(in, 0, SEEK_END))
+        file_size = ftell(in);
+    if (file_size < 32 || fseek(in, 0, SEEK_SET) ||
+        fread(head, 1, 32, in) != 32 || memcmp(head, magic, 16)) {
+        fclose(in);
+        return -1;
+    }
+
+    // Read the headers of all resources, building the tree.
+    struct res_entry *entries = NULL;
+    int nb_entries = 0;
+    const struct res_id **strings = NULL;
+    int nb_strings = 0, nb_nodes = 1;
+    struct res_node root = { { NULL, 0, 0 }, -1, -1, NULL, 0, 0 };
+    long pos = 32;
+    int ok = 1;
+    while (ok && pos < file_size) {
+        struct res_entry e;
+        uint32_t header_size, data_version, version, characteristics;
+        uint16_t memory_flags;
+        entries = realloc(entries, (nb_entries + 1) * sizeof(*entries));
+        strings = realloc(strings, (nb_strings + 2) * sizeof(*strings));
+        if (read_u32(in, &pos, &e.size) || read_u32(in, &pos, &header_size) ||
+            header_size < 32 || read_res_id(in, &pos, &e.type) ||
+            read_res_id(in, &pos, &e.name) ||
+            fseek(in, pos = align_to(pos, 4), SEEK_SET) ||
+            read_u32(in, &pos, &data_version) ||
+            read_u16(in, &pos, &memory_flags) ||
+            read_u16(in, &pos, &e.lang) || read_u32(in, &pos, &version) ||
+            read_u32(in, &pos, &characteristics) ||
+            e.size > (unsigned long) (file_size - pos)) {
+            ok = 0;
+            break;
+        }
+        e.offset = pos;
+        pos = align_to(pos + e.size, 4);
+        if (fseek(in, pos, SEEK_SET)) {
+            ok = 0;
+            break;
+        }
+        entries[nb_entries] = e;
+        struct res_node *type = res_child(&root, &entries[nb_entries].type,
+                                          -1, strings, &nb_strings,
+                                          &nb_nodes);
+        struct res_node *name = res_child(type, &entries[nb_entries].name,
+                                          -1, strings, &nb_strings,
+                                          &nb_nodes);
+        struct res_id lang = { NULL, 0, e.lang };
+        if (!res_child(name, &lang, nb_entries, strings, &nb_strings,
+                       &nb_nodes))
+            ok = 0;
+        nb_entries++;
+    }
+    if (!ok) {
+        // The tree and entries are left for the process exit.
+        fclose(in);
+        return -1;
+    }
+
+    // Lay out the file: the headers, .rsrc$01 with the tree, the strings
+    // and the relocations, .rsrc$02 with the data (each entry aligned to
+    // 8 bytes), and the symbol table.
+    uint32_t tree_size = res_tree_size(&root);
+    uint32_t *string_offsets = malloc((nb_strings + 1) * sizeof(*string_offsets));
+    uint32_t strings_size = 0;
+    for (int i = 0; i < nb_strings; i++) {
+        string_offsets[i] = tree_size + strings_size;
+        strings_size += 2 + 2 * strings[i]->len;
+    }
+    uint32_t sec1_offset = 20 + 2 * 40;
+    uint32_t sec1_size = tree_size + align_to(strings_size, 4);
+    uint32_t relocs_offset = sec1_offset + sec1_size;
+    uint32_t sec2_offset = align_to(relocs_offset + nb_entries * 10, 8);
+    uint32_t *data_offsets = malloc((nb_entries + 1) * sizeof(*data_offsets));
+    uint32_t sec2_size = 0;
+    for (int i = 0; i < nb_entries; i++) {
+        data_offsets[i] = sec2_size;
+        sec2_size += align_to(entries[i].size, 8);
+    }
+    uint32_t symtab_offset = align_to(sec2_offset + sec2_size, 8);
+
+    // Everything but the resource data is built in memory.
+    size_t head_size = sec2_offset;
+    unsigned char *out = calloc(1, head_size);
+    unsigned char *p = out;
+    time_t now = time(NULL);
+    put16(p, machine);
+    put16(p + 2, 2);
+    put32(p + 4, now < 0 || (unsigned long long) now > 0xffffffffULL
+                     ? 0xffffffff : (uint32_t) now);
+    put32(p + 8, symtab_offset);
+    put32(p + 12, nb_entries + 5);
+    put16(p + 18, 0x100); // IMAGE_FILE_32BIT_MACHINE
+    p += 20;
+    memcpy(p, ".rsrc$01", 8);
+    put32(p + 16, sec1_size);
+    put32(p + 20, sec1_offset);
+    put32(p + 24, relocs_offset);
+    put16(p + 32, nb_entries);
+    put32(p + 36, 0x40000040); // INITIALIZED_DATA | MEM_READ
+    p += 40;
+    memcpy(p, ".rsrc$02", 8);
+    put32(p + 16, sec2_size);
+    put32(p + 20, sec2_offset);
+    put32(p + 36, 0x40000040);
+
+    // The directory tables, breadth first, with the data entries after
+    // all of them.
+    unsigned char *sec1 = out + sec1_offset;
+    struct res_node **queue = malloc(nb_nodes * sizeof(*queue));
+    struct res_node **data_order = malloc(nb_nodes * sizeof(*data_order));
+    uint32_t *reloc_addrs = malloc((nb_entries + 1) * sizeof(*reloc_addrs));
+    int queue_start = 0, queue_end = 0, nb_data = 0;
+    uint32_t cur = 0, next = 16 + root.nb_children * 8;
+    queue[queue_end++] = &root;
+    while (queue_start < queue_end) {
+        struct res_node *node = queue[queue_start++];
+        put16(sec1 + cur + 12, node->nb_string_children);
+        put16(sec1 + cur + 14, node->nb_children - node->nb_string_children);
+        cur += 16;
+        for (int i = 0; i < node->nb_children; i++) {
+            struct res_node *child = node->children[i];
+            if (child->key.str)
+                put32(sec1 + cur,
+                      string_offsets[child->string_index] | 0x80000000);
+            else
+                put32(sec1 + cur, child->key.id);
+            if (child->data_index >= 0) {
+                put32(sec1 + cur + 4, next);
+                next += 16;
+                data_order[nb_data++] = child;
+            } else {
+                put32(sec1 + cur + 4, next | 0x80000000);
+                next += 16 + child->nb_children * 8;
+                queue[queue_end++] = child;
+            }
+            cur += 8;
+        }
+    }
+    for (int i = 0; i < nb_data; i++) {
+        int index = data_order[i]->data_index;
+        reloc_addrs[index] = cur;
+        put32(sec1 + cur + 4, entries[index].size);
+        cur += 16;
+    }
+    for (int i = 0; i < nb_strings; i++) {
+        put16(sec1 + cur, strings[i]->len);
+        cur += 2;
+        for (int j = 0; j < strings[i]->len; j++, cur += 2)
+            put16(sec1 + cur, strings[i]->str[j]);
+    }
+    p = out + relocs_offset;
+    for (int i = 0; i < nb_entries; i++, p += 10) {
+        put32(p, reloc_addrs[i]);
+        put32(p + 4, 5 + i);
+        put16(p + 8, reloc_type);
+    }
+
+    size_t symtab_size = (nb_entries + 5) * 18 + 4;
+    unsigned char *symtab = calloc(1, symtab_size);
+    p = symtab;
+    memcpy(p, "@feat.00", 8);
+    put32(p + 8, 0x11);
+    put16(p + 12, 0xffff);
+    p[16] = 3; // IMAGE_SYM_CLASS_STATIC
+    p += 18;
+    for (int i = 0; i < 2; i++) {
+        memcpy(p, i ? ".rsrc$02" : ".rsrc$01", 8);
+        put16(p + 12, i + 1);
+        p[16] = 3;
+        p[17] = 1;
+        p += 18;
+        put32(p, i ? sec2_size : sec1_size);
+        put16(p + 4, i ? 0 : nb_entries);
+        p += 18;
+    }
+    for (int i = 0; i < nb_entries; i++, p += 18) {
+        char name[9];
+        snprintf(name, sizeof(name), "$R%06X", i & 0xffffff);
+        memcpy(p, name, 8);
+        put32(p + 8, data_offsets[i]);
+        put16(p + 12, 2);
+        p[16] = 3;
     }
 
+    // Write the file, copying the resource data from the input.
+    FILE *f = _tfopen(output, _T("wb"));
+    int ret = 0;
+    if (!f) {
+        _tperror(output);
+        ret = 1;
+    }
+    if (!ret && fwrite(out, 1, head_size, f) != head_size)
+        ret = 1;
+    static const unsigned char zeros[8] = { 0 };
+    for (int i = 0; !ret && i < nb_entries; i++) {
+        char block[65536];
+        uint32_t left = entries[i].size;
+        if (fseek(in, entries[i].offset, SEEK_SET))
+            ret = 1;
+        while (!ret && left > 0) {
+            size_t n = left < sizeof(block) ? left : sizeof(block);
+            if (fread(block, 1, n, in) != n || fwrite(block, 1, n, f) != n)
+                ret = 1;
+            left -= n;
+        }
+        size_t pad = align_to(entries[i].size, 8) - entries[i].size;
+        if (!ret && pad && fwrite(zeros, 1, pad, f) != pad)
+            ret = 1;
+    }
+    if (!ret && fwrite(symtab, 1, symtab_size, f) != symtab_size)
+        ret = 1;
+    if (f && fclose(f))
+        ret = 1;
+    if (ret && f) {
+        _ftprintf(stderr, _T("unable to write "TS"\n"), output);
+#ifndef _WIN32
+        struct stat st;
+        if (!lstat(output, &st) && S_ISREG(st.st_mode))
+#endif
+            _tunlink(output);
+    }
+    fclose(in);
+    free(symtab);
+    free(reloc_addrs);
+    free(data_order);
+    free(queue);
+    free(out);
+    free(data_offsets);
+    free(string_offsets);
+    return ret;
+}
+
+static int run_cvtres(const TCHAR *dir, const TCHAR *res,
+                      const TCHAR *machine, const TCHAR *output,
+                      int verbose) {
+    int ret = convert_res(res, output, machine);
+    if (ret >= 0)
+        return ret;
 
-    const TCHAR *input = _T("-");
-    const TCHAR *output = _T("/dev/stdout");
+    const TCHAR *exec_argv[5];
+    exec_argv[0] = concat(dir, _T("llvm-cvtres"));
+    exec_argv[1] = escape(res);
+    exec_argv[2] = concat(_T("-machine:"), machine);
+    exec_argv[3] = escape(concat(_T("-out:"), output));
+    exec_argv[4] = NULL;
+
+    if (verbose)
+        print_argv(exec_argv);
+    ret = _tspawnvp(_P_WAIT, exec_argv[0], exec_argv);
+    if (ret == -1) {
+        _tperror(exec_argv[0]);
+        return 1;
+    }
+    return ret;
+}
+
+// Options for writing a dependency file, with -MD or -MMD.
+struct dep_options {
+    const TCHAR *path;
+    const TCHAR *target;
+    int system_headers;
+    int phony;
+};
+
+#ifndef _WIN32
+// Resource cache: With LLVM_MINGW_OBJCACHE set to a directory, the .res
+// or COFF outputs for rc inputs are stored in the object cache (see
+// native-wrapper.h), under a hash of the preprocessed script, the
+// contents of the files it refers to (icons, manifests, RCDATA blobs and
+// so on), the codepage, the target machine and the identity of llvm-rc
+// and llvm-cvtres. Rather than parsing the resource statements, every
+// token in the script that names an existing file, relative to the
+// current directory, the directory of the input, an include directory or
+// a directory in $INCLUDE (like llvm-rc looks for them), is treated as a
+// reference; at worst this hashes some file that isn't used.
+
+typedef void (*reference_fn)(void *opaque, const char *path);
+
+static void find_reference(const char *token, size_t len,
+                           const char *const *dirs, int nb_dirs,
+                           reference_fn fn, void *opaque) {
+    if (len == 0 || len > 1024)
+        return;
+    char name[1025];
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        // Both "dir\\file" and "dir\file" refer to dir/file.
+        if (token[i] == '\\') {
+            if (i + 1 < len && token[i + 1] == '\\')
+                i++;
+            name[n++] = '/';
+        } else {
+            name[n++] = token[i];
+        }
+    }
+    name[n] = '\0';
+    struct stat st;
+    if (!stat(name, &st) && S_ISREG(st.st_mode))
+        fn(opaque, name);
+    if (name[0] == '/')
+        return;
+    for (int i = 0; i < nb_dirs; i++) {
+        char *path = path_join(dirs[i], name);
+        if (!stat(path, &st) && S_ISREG(st.st_mode))
+            fn(opaque, path);
+        free(path);
+    }
+}
+
+// Call fn for each existing file that a token in the preprocessed script
+// may refer to.
+static void find_references(const char *text, size_t len,
+                            const char *const *dirs, int nb_dirs,
+                            reference_fn fn, void *opaque) {
+    const char *ptr = text, *end = text + len;
+    int line_start = 1;
+    while (ptr < end) {
+        if (*ptr == '\n') {
+            line_start = 1;
+            ptr++;
+        } else if (*ptr == ' ' || *ptr == '\t' || *ptr == '\r') {
+            ptr++;
+        } else if (line_start && *ptr == '#') {
+            // Line markers from the preprocessor.
+            while (ptr < end && *ptr != '\n')
+                ptr++;
+        } else if (*ptr == '"') {
+            const char *start = ++ptr;
+            while (ptr < end && *ptr != '"' && *ptr != '\n')
+                ptr++;
+            find_reference(start, ptr - start, dirs, nb_dirs, fn, opaque);
+            if (ptr < end && *ptr == '"')
+                ptr++;
+            line_start = 0;
+        } else if (strchr(",{}()", *ptr)) {
+            ptr++;
+            line_start = 0;
+        } else {
+            const char *start = ptr;
+            while (ptr < end && !strchr(" \t\r\n\",{}()", *ptr))
+                ptr++;
+            if (memchr(start, '.', ptr - start) ||
+                memchr(start, '/', ptr - start))
+                find_reference(start, ptr - start, dirs, nb_dirs, fn, opaque);
+            line_start = 0;
+        }
+    }
+}
+
+// Dependency files: With -MD, a make style dependency file is written
+// (to the -MF file, or next to the output), listing the input, the
+// headers it includes, taken from the line markers in the preprocessed
+// script, and the files it refers to, found like for the resource cache
+// above. With -MMD, system headers are left out.
+struct deps {
+    char **paths;
+    int nb;
+};
+
+static void add_dep(void *opaque, const char *path) {
+    struct deps *deps = opaque;
+    while (!strncmp(path, "./", 2))
+        path += 2;
+    for (int i = 0; i < deps->nb; i++)
+        if (!strcmp(deps->paths[i], path))
+            return;
+    deps->paths = realloc(deps->paths, (deps->nb + 1) * sizeof(*deps->paths));
+    deps->paths[deps->nb++] = strdup(path);
+}
+
+static void add_included_deps(struct deps *deps, const char *text,
+                              size_t len, int system_headers) {
+    const char *ptr = text, *end = text + len;
+    while (ptr < end) {
+        const char *eol = memchr(ptr, '\n', end - ptr);
+        if (!eol)
+            eol = end;
+        // Line markers look like: # 12 "file.h" 1 3
+        const char *p = ptr;
+        if (*p++ == '#') {
+            while (p < eol && *p == ' ')
+                p++;
+            const char *digits = p;
+            while (p < eol && *p >= '0' && *p <= '9')
+                p++;
+            while (p < eol && *p == ' ')
+                p++;
+            if (p > digits && p < eol && *p == '"') {
+                struct buf name = { 0 };
+                for (p++; p < eol && *p != '"'; p++) {
+                    if (*p == '\\' && p + 1 < eol)
+                        p++;
+                    buf_append(&name, p, 1);
+                }
+                buf_append(&name, "", 1);
+                // Flag 3 marks a system header.
+                int system = 0;
+                for (; p < eol; p++)
+                    if (*p == '3' && p[-1] == ' ')
+                        system = 1;
+                if (name.data[0] != '<' && (system_headers || !system))
+                    add_dep(deps, name.data);
+                free(name.data);
+            }
+        }
+        ptr = eol + 1;
+    }
+}
+
+static void put_make_escaped(FILE *f, const char *str) {
+    for (; *str; str++) {
+        if (*str == ' ' || *str == '\t' || *str == '#')
+            fputc('\\', f);
+        else if (*str == '$')
+            fputc('$', f);
+        fputc(*str, f);
+    }
+}
+
+static int write_depfile(const struct dep_options *opts, struct deps *deps) {
+    FILE *f = fopen(opts->path, "w");
+    if (!f) {
+        perror(opts->path);
+        return 1;
+    }
+    put_make_escaped(f, opts->target);
+    fputc(':', f);
+    for (int i = 0; i < deps->nb; i++) {
+        fputs(i ? " \\\n  " : " ", f);
+        put_make_escaped(f, deps->paths[i]);
+    }
+    fputc('\n', f);
+    // With -MP, a phony target for each dependency but the input, so that
+    // make doesn't fail when one is removed.
+    for (int i = 1; opts->phony && i < deps->nb; i++) {
+        fputc('\n', f);
+        put_make_escaped(f, deps->paths[i]);
+        fputs(":\n", f);
+    }
+    for (int i = 0; i < deps->nb; i++)
+        free(deps->paths[i]);
+    free(deps->paths);
+    if (ferror(f) | fclose(f)) {
+        perror(opts->path);
+        unlink(opts->path);
+        return 1;
+    }
+    return 0;
+}
+
+// Compile an rc file with the preprocessed script in memory, for the
+// cache (if cache_dir is set) or the dependency file (if deps->path is
+// set), with rc_argv reading the preprocessed script from stdin and
+// writing res (the output, for res output that can be written directly).
+// Returns the exit code.
+static int compile_rc_buffered(const char *basename, const char *cache_dir,
+                               const struct dep_options *dep_opts,
+                               const char **cpp_argv,
+                               const char **rc_argv, const char *dir,
+                               const char *machine, const char *codepage,
+                               const char *inputdir, const char **includes,
+                               int nb_includes, const char *res,
+                               const char *output, int to_res, int verbose) {
+    if (verbose) {
+        print_argv(cpp_argv);
+        print_argv(rc_argv);
+    }
+    char *rsp_path = NULL;
+    const char **rsp_argv = write_response_file(cpp_argv, 1, &rsp_path);
+    struct buf text = { 0 };
+    int fd;
+    pid_t pid = spawn_piped(rsp_argv ? rsp_argv : cpp_argv, 1, -1, &fd);
+    if (pid < 0) {
+        perror(cpp_argv[0]);
+        return 1;
+    }
+    read_all(fd, &text);
+    int ret = wait_child(pid);
+    if (rsp_path)
+        unlink(rsp_path);
+    if (ret != 0) {
+        if (res != output)
+            unlink(res);
+        error(basename, "preprocessor failed");
+    }
+
+    const char *include_env = getenv("INCLUDE");
+    const char **dirs = malloc((nb_includes + 2) * sizeof(*dirs));
+    int nb_dirs = 0;
+    dirs[nb_dirs++] = inputdir;
+    for (int i = 0; i < nb_includes; i++)
+        dirs[nb_dirs++] = includes[i];
+    char *env_dirs = include_env ? strdup(include_env) : NULL;
+    for (char *d = env_dirs ? strtok(env_dirs, ":") : NULL; d;
+         d = strtok(NULL, ":")) {
+        dirs = realloc(dirs, (nb_dirs + 1) * sizeof(*dirs));
+        dirs[nb_dirs++] = d;
+    }
+
+    char hash[65];
+    const char *ext = to_res ? ".res" : ".o";
+    int hit = 0;
+    if (cache_dir) {
+        struct buf key = { 0 };
+        buf_append_token(&key, "llvm-mingw-rccache-1");
+        append_tool_identity(&key, rc_argv[0]);
+        if (!to_res) {
+            char *cvtres = concat(dir, "llvm-cvtres");
+            append_tool_identity(&key, cvtres);
+            free(cvtres);
+        }
+        buf_append_token(&key, machine);
+        buf_append_token(&key, codepage);
+        buf_append_token(&key, to_res ? "res" : "coff");
+        for (int i = 1; rc_argv[i]; i++)
+            if (strcmp(rc_argv[i], res))
+                buf_append_token(&key, rc_argv[i]);
+        buf_append_token(&key, include_env ? include_env : "");
+
+        struct sha256 sha;
+        sha256_init(&sha);
+        sha256_update(&sha, key.data, key.len);
+        sha256_update(&sha, text.data, text.len);
+        find_references(text.data, text.len, dirs, nb_dirs,
+                        hash_file_contents, &sha);
+        sha256_final(&sha, hash);
+        free(key.data);
+
+        hit = objcache_get(cache_dir, hash, ext, output, NULL);
+        if (hit && res != output)
+            unlink(res);
+    }
+
+    if (!hit) {
+        int fds[2];
+        if (pipe_cloexec(fds)) {
+            perror("pipe");
+            return 1;
+        }
+        int rc_fds[3] = { fds[0], -1, -1 };
+        pid = spawn_process(rc_argv[0], rc_argv, rc_fds);
+        close(fds[0]);
+        if (pid < 0) {
+            close(fds[1]);
+            perror(rc_argv[0]);
+            return 1;
+        }
+        // llvm-rc reads all of its input before writing anything, so this
+        // can't deadlock.
+        signal(SIGPIPE, SIG_IGN);
+        for (size_t pos = 0; pos < text.len; ) {
+            ssize_t n = write(fds[1], text.data + pos, text.len - pos);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            pos += n;
+        }
+        close(fds[1]);
+        ret = wait_child(pid);
+        if (ret != 0) {
+            if (!verbose && res != output)
+                unlink(res);
+            error(basename, "llvm-rc failed");
+        }
+        if (!to_res) {
+            ret = run_cvtres(dir, res, machine, output, verbose);
+            if (!verbose)
+                unlink(res);
+        } else if (res != output) {
+            ret = stream_file(res, output);
+            if (ret)
+                perror(output);
+            unlink(res);
+        }
+        if (ret == 0 && cache_dir)
+            objcache_put(cache_dir, hash, ext, output, NULL, NULL);
+    }
+
+    if (ret == 0 && dep_opts->path) {
+        struct deps deps = { 0 };
+        add_included_deps(&deps, text.data, text.len,
+                          dep_opts->system_headers);
+        find_references(text.data, text.len, dirs, nb_dirs, add_dep, &deps);
+        ret = write_depfile(dep_opts, &deps);
+    }
+    free(text.data);
+    free(env_dirs);
+    free(dirs);
+    return ret;
+}
+#endif
+
+// Batch mode, for invocations with multiple -i/-o pairs (possibly from a
+// response file): each pair is compiled by rerunning this wrapper with
+// the other options, at most LLVM_MINGW_JOBS (by default the number of
+// CPUs) at the same time on unix hosts. The diagnostics of each are
+// printed in the order of the pairs.
+static int run_batch(const TCHAR **common, int nb_common,
+                     const TCHAR **inputs, const TCHAR **outputs, int nb) {
+    const TCHAR ***job_argvs = malloc(nb * sizeof(*job_argvs));
+    for (int job = 0; job < nb; job++) {
+        const TCHAR **job_argv = malloc((nb_common + 5) * sizeof(*job_argv));
+        int n = 0;
+        for (int i = 0; i < nb_common; i++)
+            job_argv[n++] = i ? escape(common[i]) : common[i];
+        job_argv[n++] = _T("-i");
+        job_argv[n++] = escape(inputs[job]);
+        job_argv[n++] = _T("-o");
+        job_argv[n++] = escape(outputs[job]);
+        job_argv[n] = NULL;
+        job_argvs[job] = job_argv;
+    }
+#ifdef _WIN32
+    int ret = 0;
+    for (int job = 0; job < nb; job++) {
+        int job_ret = _tspawnvp(_P_WAIT, job_argvs[job][0], job_argvs[job]);
+        if (job_ret == -1) {
+            _tperror(job_argvs[job][0]);
+            job_ret = 1;
+        }
+        if (job_ret != 0 && ret == 0)
+            ret = job_ret;
+    }
+    return ret;
+#else
+    return run_parallel(job_argvs, nb, get_job_limit());
+#endif
+}
+
+int _tmain(int argc, TCHAR* argv[]) {
+    const TCHAR *dir;
+    const TCHAR *basename;
+    const TCHAR *target;
+    const TCHAR *exe;
+    split_argv(argv[0], &dir, &basename, &target, &exe);
+    expand_response_files(&argc, &argv);
+
+    const TCHAR **inputs = malloc(argc * sizeof(*inputs));
+    const TCHAR **outputs = malloc(argc * sizeof(*outputs));
+    int nb_inputs = 0, nb_outputs = 0;
+    const TCHAR **common = malloc((argc + 5) * sizeof(*common));
+    int nb_common = 0;
     const TCHAR *input_format = _T("rc");
     const TCHAR *output_format = _T("coff");
     const TCHAR **includes = malloc(argc * sizeof(*includes));
@@ -266,6 +991,8 @@ int _tmain(int argc, TCHAR* argv[]) {
     const TCHAR **cpp_options = malloc(argc * sizeof(*cpp_options));
     int nb_cpp_options = 0;
     int verbose = 0;
+    struct dep_options dep_opts = { 0 };
+    int write_deps = 0;
 
 #define _tcsstart(a, b) !_tcsncmp(a, b, sizeof(b)/sizeof(TCHAR) - 1)
 
@@ -293,9 +1020,11 @@ int _tmain(int argc, TCHAR* argv[]) {
             error(basename, _T(TS" missing argument"), argv[i]); \
     } while (0)
 
+    common[nb_common++] = argv[0];
     for (int i = 1; i < argc; i++) {
-        OPTION("-i", "--input", input)
-        else OPTION("-o", "--output", output)
+        int start = i, files = nb_inputs + nb_outputs;
+        OPTION("-i", "--input", inputs[nb_inputs++])
+        else OPTION("-o", "--output", outputs[nb_outputs++])
         else OPTION("-J", "--input-format", input_format)
         else OPTION("-O", "--output-format", output_format)
         else OPTION("-F", "--target", target)
@@ -320,6 +1049,22 @@ int _tmain(int argc, TCHAR* argv[]) {
             SEPARATE_ARG_PREFIX(cpp_options[nb_cpp_options++], "-U");
         } else if (_tcsstart(argv[i], _T("-U"))) {
             cpp_options[nb_cpp_options++] = argv[i];
+        } else if (!_tcscmp(argv[i], _T("-MD"))) {
+            write_deps = 1;
+            dep_opts.system_headers = 1;
+        } else if (!_tcscmp(argv[i], _T("-MMD"))) {
+            write_deps = 1;
+            dep_opts.system_headers = 0;
+        } else if (!_tcscmp(argv[i], _T("-MP"))) {
+            dep_opts.phony = 1;
+        } else if (!_tcscmp(argv[i], _T("-MF"))) {
+            SEPARATE_ARG(dep_opts.path);
+        } else if (_tcsstart(argv[i], _T("-MF"))) {
+            dep_opts.path = argv[i] + 3;
+        } else if (!_tcscmp(argv[i], _T("-MT"))) {
+            SEPARATE_ARG(dep_opts.target);
+        } else if (_tcsstart(argv[i], _T("-MT"))) {
+            dep_opts.target = argv[i] + 3;
         } else IF_MATCH_EITHER("-v", "--verbose") {
             verbose = 1;
         } else IF_MATCH_EITHER("-V", "--version") {
@@ -327,23 +1072,57 @@ int _tmain(int argc, TCHAR* argv[]) {
         } else IF_MATCH_EITHER("-h", "--help") {
             print_help();
         } else if (!_tcscmp(argv[i], _T("--use-temp-file"))) {
-            // No-op, we use a temp file by default.
+            // No-op; the preprocessor output is piped to llvm-rc where
+            // possible, and written to a temp file otherwise.
         } else if (_tcsstart(argv[i], _T("-"))) {
             error(basename, _T("unrecognized option: `"TS"'"), argv[i]);
         } else {
-            if (!_tcscmp(input, _T("-")))
-                input = argv[i];
-            else if (!_tcscmp(output, _T("/dev/stdout")))
-                output = argv[i];
+            if (!nb_inputs)
+                inputs[nb_inputs++] = argv[i];
+            else if (!nb_outputs)
+                outputs[nb_outputs++] = argv[i];
             else
                 error(basename, _T("rip: `"TS"'"), argv[i]);
         }
+        // Keep the other options for the batch jobs.
+        if (nb_inputs + nb_outputs == files)
+            while (start <= i)
+                common[nb_common++] = argv[start++];
     }
 
-    TCHAR *arch = _tcsdup(target);
-    dash = _tcschr(arch, '-');
-    if (dash)
-        *dash = '\0';
+    if (nb_inputs > 1 || nb_outputs > 1) {
+        if (nb_inputs != nb_outputs)
+            error(basename, _T("multiple inputs need an output each"));
+        if (dep_opts.path || dep_opts.target)
+            error(basename, _T("-MF and -MT can't be used with multiple inputs"));
+        return run_batch(common, nb_common, inputs, outputs, nb_inputs);
+    }
+    const TCHAR *input = nb_inputs ? inputs[0] : _T("-");
+    const TCHAR *output = nb_outputs ? outputs[0] : _T("/dev/stdout");
+
+    if (write_deps) {
+#ifdef _WIN32
+        error(basename, _T("dependency files are only supported on unix hosts"));
+#endif
+        // Like the compilers, by default write the dependency file next to
+        // the output, as output.d without the extension.
+        if (!dep_opts.path) {
+            if (!nb_outputs)
+                error(basename, _T("-MD needs an output file or -MF"));
+            TCHAR *path = _tcsdup(output);
+            TCHAR *dot = _tcsrchr(path, '.');
+            TCHAR *sep = _tcsrchrs(path, '/', '\\');
+            if (dot && (!sep || dot > sep))
+                *dot = '\0';
+            dep_opts.path = concat(path, _T(".d"));
+        }
+        if (!dep_opts.target)
+            dep_opts.target = output;
+    } else {
+        dep_opts.path = NULL;
+    }
+
+    TCHAR *arch = get_arch(target);
 
     const TCHAR *machine = _T("unknown");
     if (!_tcscmp(arch, _T("i686")))
@@ -368,9 +1147,6 @@ int _tmain(int argc, TCHAR* argv[]) {
     for (int i = 0; i < nb_cpp_options; i++)
         cpp_options[i] = unescape_cpp(cpp_options[i]);
 
-    const TCHAR *preproc_rc = concat(output, _T(".preproc.rc"));
-    const TCHAR *res = concat(output, _T(".out.res"));
-
     TCHAR *inputdir = _tcsdup(input);
     {
         TCHAR *sep = _tcsrchrs(inputdir, '/', '\\');
@@ -386,29 +1162,55 @@ int _tmain(int argc, TCHAR* argv[]) {
     int arg = 0;
 
     if (!_tcscmp(input_format, _T("rc"))) {
-        exec_argv[arg++] = concat(dir, CC);
-        exec_argv[arg++] = _T("-E");
-        for (int i = 0; i < nb_cpp_options; i++)
-            exec_argv[arg++] = escape(cpp_options[i]);
-        exec_argv[arg++] = _T("-xc");
-        exec_argv[arg++] = _T("-DRC_INVOKED=1");
-        exec_argv[arg++] = escape(input);
-        exec_argv[arg++] = _T("-o");
-        exec_argv[arg++] = escape(preproc_rc);
-        exec_argv[arg] = NULL;
+        int to_res = !_tcscmp(output_format, _T("res"));
+        if (!to_res && _tcscmp(output_format, _T("coff")))
+            error(basename, _T("invalid output format: `"TS"'"), output_format);
 
-        if (verbose)
-            print_argv(exec_argv);
-        int ret = _tspawnvp(_P_WAIT, exec_argv[0], exec_argv);
-        if (ret == -1) {
-            _tperror(exec_argv[0]);
-            return 1;
-        }
-        if (ret != 0) {
-            error(basename, _T("preprocessor failed"));
-            return ret;
+        // The .res file is written by llvm-rc, which seeks in its output,
+        // so it can't be a pipe. Unless it is the final output, it is a
+        // temporary file; the output may be /dev/stdout (the default), so
+        // no names are derived from it. Outputs that aren't plain files
+        // can't be replaced by renaming a file either, so a .res is copied
+        // to them.
+        const TCHAR *res = output;
+        int plain_output = 1, copy_res = 0;
+#ifndef _WIN32
+        struct stat st;
+        plain_output = lstat(output, &st) ? errno == ENOENT
+                                          : S_ISREG(st.st_mode);
+        copy_res = to_res && !plain_output;
+#endif
+        if (!to_res || copy_res) {
+            res = create_temp_file(_T("res"));
+            if (!res)
+                error(basename, _T("unable to create a temporary file"));
         }
 
+        const TCHAR **cpp_argv = malloc(max_arg * sizeof(*cpp_argv));
+        arg = 0;
+        cpp_argv[arg++] = concat(dir, CC);
+        cpp_argv[arg++] = _T("-E");
+        for (int i = 0; i < nb_cpp_options; i++)
+            cpp_argv[arg++] = escape(cpp_options[i]);
+        cpp_argv[arg++] = _T("-xc");
+        cpp_argv[arg++] = _T("-DRC_INVOKED=1");
+        cpp_argv[arg++] = escape(input);
+#ifdef _WIN32
+        // No pipes between the stages here; the preprocessed source goes
+        // to a temporary file.
+        const TCHAR *preproc_rc = create_temp_file(_T("rc"));
+        if (!preproc_rc)
+            error(basename, _T("unable to create a temporary file"));
+        cpp_argv[arg++] = _T("-o");
+        cpp_argv[arg++] = escape(preproc_rc);
+#else
+        // The preprocessor writes to a pipe that llvm-rc reads, so both
+        // run at the same time. llvm-rc would parse "/dev/stdin" as a /d
+        // (define) option, hence the "/./".
+        const TCHAR *preproc_rc = _T("/./dev/stdin");
+#endif
+        cpp_argv[arg] = NULL;
+
         arg = 0;
         exec_argv[arg++] = concat(dir, _T("llvm-rc"));
         for (int i = 0; i < nb_rc_options; i++)
@@ -419,65 +1221,134 @@ int _tmain(int argc, TCHAR* argv[]) {
         exec_argv[arg++] = _T("-c");
         exec_argv[arg++] = codepage;
         exec_argv[arg++] = _T("-fo");
-        if (!_tcscmp(output_format, _T("res")))
-            exec_argv[arg++] = escape(output);
-        else
-            exec_argv[arg++] = escape(res);
+        exec_argv[arg++] = escape(res);
         exec_argv[arg] = NULL;
 
-        if (verbose)
+#ifndef _WIN32
+        const char *objcache = getenv("LLVM_MINGW_OBJCACHE");
+        if (!objcache || !*objcache || !plain_output)
+            objcache = NULL;
+        if (objcache || dep_opts.path)
+            return compile_rc_buffered(basename, objcache, &dep_opts,
+                                       cpp_argv, exec_argv, dir, machine,
+                                       codepage, inputdir, includes,
+                                       nb_includes, res, output, to_res,
+                                       verbose);
+#endif
+
+        if (verbose) {
+            print_argv(cpp_argv);
             print_argv(exec_argv);
-        ret = _tspawnvp(_P_WAIT, exec_argv[0], exec_argv);
+        }
+#ifdef _WIN32
+        int ret = spawn_clang(cpp_argv);
         if (ret == -1) {
+            _tperror(cpp_argv[0]);
+            return 1;
+        }
+        if (ret != 0) {
+            _tunlink(preproc_rc);
+            if (res != output)
+                _tunlink(res);
+            error(basename, _T("preprocessor failed"));
+            return ret;
+        }
+        int rc_ret = _tspawnvp(_P_WAIT, exec_argv[0], exec_argv);
+        if (!verbose)
+            _tunlink(preproc_rc);
+        if (rc_ret == -1) {
             _tperror(exec_argv[0]);
             return 1;
         }
+#else
+        TCHAR *rsp_path = NULL;
+        const TCHAR **rsp_argv = write_response_file(cpp_argv, 1, &rsp_path);
+        if (rsp_argv)
+            cpp_argv = rsp_argv;
+        int fds[2];
+        if (pipe_cloexec(fds)) {
+            perror("pipe");
+            return 1;
+        }
+        int cpp_fds[3] = { -1, fds[1], -1 };
+        int rc_fds[3] = { fds[0], -1, -1 };
+        pid_t cpp = spawn_process(cpp_argv[0], cpp_argv, cpp_fds);
+        close(fds[1]);
+        if (cpp < 0) {
+            perror(cpp_argv[0]);
+            return 1;
+        }
+        pid_t rc = spawn_process(exec_argv[0], exec_argv, rc_fds);
+        close(fds[0]);
+        int rc_ret = rc < 0 ? -1 : wait_child(rc);
+        int ret = wait_child(cpp);
+        if (rsp_path)
+            unlink(rsp_path);
+        if (rc < 0) {
+            perror(exec_argv[0]);
+            return 1;
+        }
+        // If the preprocessor failed, llvm-rc most likely did as well, on
+        // the truncated input; report the first failure.
         if (ret != 0) {
-            error(basename, _T("llvm-rc failed"));
-            if (!verbose)
-                _tunlink(preproc_rc);
+            if (res != output)
+                unlink(res);
+            error(basename, _T("preprocessor failed"));
             return ret;
         }
+        if (rc_ret == -1) {
+            perror(exec_argv[0]);
+            return 1;
+        }
+#endif
+        if (rc_ret != 0) {
+            if (!verbose && res != output)
+                _tunlink(res);
+            error(basename, _T("llvm-rc failed"));
+            return rc_ret;
+        }
+
+        if (to_res) {
+#ifndef _WIN32
+            if (copy_res) {
+                ret = stream_file(res, output);
+                if (ret)
+                    perror(output);
+                unlink(res);
+                return ret;
+            }
+#endif
+            return 0;
+        }
 
-        if (!_tcscmp(output_format, _T("res"))) {
-            // All done
-        } else if (!_tcscmp(output_format, _T("coff"))) {
-            arg = 0;
+        ret = run_cvtres(dir, res, machine, output, verbose);
+        if (!verbose)
+            _tunlink(res);
+        return ret;
+    } else if (!_tcscmp(input_format, _T("res"))) {
+        int ret = convert_res(input, output, machine);
+        if (ret < 0) {
             exec_argv[arg++] = concat(dir, _T("llvm-cvtres"));
-            exec_argv[arg++] = escape(res);
+            exec_argv[arg++] = escape(input);
             exec_argv[arg++] = concat(_T("-machine:"), machine);
             exec_argv[arg++] = escape(concat(_T("-out:"), output));
             exec_argv[arg] = NULL;
 
             if (verbose)
                 print_argv(exec_argv);
-            int ret = _tspawnvp(_P_WAIT, exec_argv[0], exec_argv);
+            ret = spawn_clang(exec_argv);
             if (ret == -1) {
                 _tperror(exec_argv[0]);
                 return 1;
             }
-            if (!verbose) {
-                _tunlink(preproc_rc);
-                _tunlink(res);
-            }
-            return ret;
-        } else {
-            error(basename, _T("invalid output format: `"TS"'"), output_format);
         }
-    } else if (!_tcscmp(input_format, _T("res"))) {
-        exec_argv[arg++] = concat(dir, _T("llvm-cvtres"));
-        exec_argv[arg++] = escape(input);
-        exec_argv[arg++] = concat(_T("-machine:"), machine);
-        exec_argv[arg++] = escape(concat(_T("-out:"), output));
-        exec_argv[arg] = NULL;
-
-        if (verbose)
-            print_argv(exec_argv);
-        int ret = _tspawnvp(_P_WAIT, exec_argv[0], exec_argv);
-        if (ret == -1) {
-            _tperror(exec_argv[0]);
-            return 1;
+#ifndef _WIN32
+        if (ret == 0 && dep_opts.path) {
+            struct deps deps = { 0 };
+            add_dep(&deps, input);
+            ret = write_depfile(&dep_opts, &deps);
         }
+#endif
         return ret;
     } else {
         error(basename, _T("invalid input format: `"TS"'"), input_format);